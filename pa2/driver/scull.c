@@ -20,13 +20,28 @@
 
 #include <linux/kernel.h>	/* printk() */
 #include <linux/slab.h>		/* kmalloc() */
+#include <linux/mm.h>		/* kvmalloc() */
+#include <linux/sched/signal.h>	/* for_each_thread() */
+#include <linux/pid.h>		/* find_vpid() */
+#include <linux/ptrace.h>	/* ptrace_may_access() */
 #include <linux/fs.h>		/* everything... */
 #include <linux/errno.h>	/* error codes */
+#include <linux/err.h>		/* ERR_PTR() */
+#include <linux/overflow.h>	/* struct_size() */
 #include <linux/types.h>	/* size_t */
 #include <linux/cdev.h>
 
 #include <linux/uaccess.h>	/* copy_*_user */
-#include <linux/mutex.h> 	/* mutex */
+#include <linux/spinlock.h>	/* spinlock_t */
+#include <linux/rculist.h>	/* hlist_add_head_rcu() */
+#include <linux/hash.h>		/* hash_64() */
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/kfifo.h>	/* the sample ring */
+#include <linux/workqueue.h>	/* the sampler */
+#include <linux/wait.h>		/* wait queues */
+#include <linux/mutex.h>	/* mutex */
+#include <linux/ktime.h>	/* ktime_get_ns() */
 
 #include "scull.h"		/* local definitions */
 #include "access_ok_version.h"
@@ -38,35 +53,536 @@
 static int scull_major =   SCULL_MAJOR;
 static int scull_minor =   0;
 static int scull_quantum = SCULL_QUANTUM;
-static DEFINE_MUTEX(mutex);
+static int scull_task_bits = SCULL_TASK_BITS;	/* log2 registry buckets */
+static int scull_sample_ms = 0;			/* 0: not sampling */
+static int scull_sample_ring = SCULL_SAMPLE_RING;	/* records */
 
 module_param(scull_major, int, S_IRUGO);
 module_param(scull_minor, int, S_IRUGO);
 module_param(scull_quantum, int, S_IRUGO);
+module_param(scull_task_bits, int, S_IRUGO);
+module_param(scull_sample_ms, int, S_IRUGO);
+module_param(scull_sample_ring, int, S_IRUGO);
 
 MODULE_AUTHOR("Wonderful student of CS-492");
 MODULE_LICENSE("Dual BSD/GPL");
 
 static struct cdev scull_cdev;		/* Char device structure		*/
-struct task_info output; 		/* initialize a task_info struct */
-struct linked_list* ll;			/* initialize a linked_list struct */ 
+
+/*
+ * Task registry
+ *
+ * Every (pid, tgid) that has asked for its task_info is remembered until
+ * the module goes away, in a hash table of 1 << scull_task_bits buckets.
+ * Lookups walk one bucket under rcu_read_lock() alone; only a task's
+ * first registration takes a lock, and then only its bucket's. A task
+ * only ever registers itself, so nobody can add the same key between the
+ * lookup and the insert. Entries are appended to their bucket and stay
+ * until module unload, see scull/tasks in debugfs.
+ */
+struct scull_task {
+	struct hlist_node node;
+	pid_t pid;
+	pid_t tgid;
+	/* as the sampler last saw the task, only it looks at these */
+	unsigned long nvcsw, nivcsw;
+	int cpu;
+	bool sampled, exited;
+};
+
+struct scull_bucket {
+	struct hlist_head head;
+	spinlock_t lock;		/* inserts into head */
+};
+
+static struct scull_bucket *scull_tasks;
+
+static struct scull_bucket *scull_task_bucket(pid_t pid, pid_t tgid)
+{
+	return &scull_tasks[hash_64((u64)tgid << 32 | (u32)pid,
+			scull_task_bits)];
+}
+
+/* entries are never freed before unload, so t stays good after unlock */
+static struct scull_task *scull_task_find(struct scull_bucket *b, pid_t pid,
+		pid_t tgid)
+{
+	struct scull_task *t, *found = NULL;
+
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(t, &b->head, node) {
+		if (t->pid == pid && t->tgid == tgid) {
+			found = t;
+			break;
+		}
+	}
+	rcu_read_unlock();
+	return found;
+}
+
+/* remember current, unless it already is, and return its entry */
+static struct scull_task *scull_task_register(void)
+{
+	struct scull_bucket *b = scull_task_bucket(current->pid, current->tgid);
+	struct hlist_node *last;
+	struct scull_task *t;
+
+	t = scull_task_find(b, current->pid, current->tgid);
+	if (t)
+		return t;
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return ERR_PTR(-ENOMEM);
+	t->pid = current->pid;
+	t->tgid = current->tgid;
+	spin_lock(&b->lock);
+	for (last = b->head.first; last && last->next; last = last->next)
+		;
+	if (last)
+		hlist_add_behind_rcu(&t->node, last);
+	else
+		hlist_add_head_rcu(&t->node, &b->head);
+	spin_unlock(&b->lock);
+	return t;
+}
+
+static int scull_tasks_alloc(void)
+{
+	int i;
+
+	scull_tasks = kvmalloc_array(1 << scull_task_bits,
+			sizeof(*scull_tasks), GFP_KERNEL);
+	if (!scull_tasks)
+		return -ENOMEM;
+	for (i = 0; i < 1 << scull_task_bits; i++) {
+		INIT_HLIST_HEAD(&scull_tasks[i].head);
+		spin_lock_init(&scull_tasks[i].lock);
+	}
+	return 0;
+}
+
+/* forget everyone who registered; nobody can look any more */
+static void scull_tasks_free(void)
+{
+	struct scull_task *t;
+	struct hlist_node *tmp;
+	int i, count = 0;
+
+	if (!scull_tasks)
+		return;
+	for (i = 0; i < 1 << scull_task_bits; i++) {
+		hlist_for_each_entry_safe(t, tmp, &scull_tasks[i].head, node) {
+			count++;
+			kfree(t);
+		}
+	}
+	kvfree(scull_tasks);
+	scull_tasks = NULL;
+	printk(KERN_INFO "scull: %d tasks were registered\n", count);
+}
+
+/*
+ * Task info
+ */
+
+/* what struct task_info reports about p; a kernel address only to p */
+static void scull_task_info(struct task_struct *p, struct task_info *ti)
+{
+	ti->state = READ_ONCE(p->state);
+	ti->stack = p == current ? p->stack : NULL;
+	ti->cpu = task_cpu(p);
+	ti->prio = p->prio;
+	ti->static_prio = p->static_prio;
+	ti->normal_prio = p->normal_prio;
+	ti->rt_priority = p->rt_priority;
+	ti->pid = p->pid;
+	ti->tgid = p->tgid;
+	ti->nvcsw = p->nvcsw;
+	ti->nivcsw = p->nivcsw;
+}
+
+/* errs[] for p: other tasks need the access their /proc/<pid>/stat wants */
+static __s32 scull_task_err(struct task_struct *p)
+{
+	if (!p || p->exit_state)
+		return -ESRCH;
+	if (p != current && !ptrace_may_access(p, PTRACE_MODE_READ_FSCREDS))
+		return -EPERM;
+	return 0;
+}
+
+/*
+ * SCULL_IOCBINFO, see scull.h. Tasks can only be looked at under
+ * rcu_read_lock(), so everything is gathered into kernel buffers first
+ * and copied out in one go at the end.
+ */
+
+static long scull_batch_info(struct scull_task_batch __user *ubatch)
+{
+	struct scull_task_batch batch;
+	struct task_struct *p, *t;
+	struct task_info *infos;
+	pid_t *pids;
+	__s32 *errs;
+	u32 n = 0, total = 0;
+	long ret;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	if (batch.nr > SCULL_BATCH_MAX || batch.flags & ~SCULL_BATCH_TGID)
+		return -EINVAL;
+
+	pids = kvmalloc_array(batch.nr, sizeof(*pids), GFP_KERNEL);
+	infos = kvcalloc(batch.nr, sizeof(*infos), GFP_KERNEL);
+	errs = kvmalloc_array(batch.nr, sizeof(*errs), GFP_KERNEL);
+	ret = -ENOMEM;
+	if (!pids || !infos || !errs)
+		goto out;
+	ret = -EFAULT;
+	if (!(batch.flags & SCULL_BATCH_TGID) &&
+	    copy_from_user(pids, u64_to_user_ptr(batch.pids),
+			   batch.nr * sizeof(*pids)))
+		goto out;
+
+	ret = 0;
+	rcu_read_lock();
+	if (batch.flags & SCULL_BATCH_TGID) {
+		p = pid_task(find_vpid(batch.tgid), PIDTYPE_PID);
+		if (!p || !thread_group_leader(p)) {
+			ret = -ESRCH;
+		} else {
+			for_each_thread(p, t) {
+				total++;
+				if (n == batch.nr)
+					continue;
+				pids[n] = task_pid_vnr(t);
+				errs[n] = scull_task_err(t);
+				if (!errs[n])
+					scull_task_info(t, &infos[n]);
+				n++;
+			}
+		}
+	} else {
+		for (n = 0; n < batch.nr; n++) {
+			p = pid_task(find_vpid(pids[n]), PIDTYPE_PID);
+			errs[n] = scull_task_err(p);
+			if (!errs[n])
+				scull_task_info(p, &infos[n]);
+		}
+		total = n;
+	}
+	rcu_read_unlock();
+	if (ret)
+		goto out;
+
+	batch.nr = n;
+	batch.total = total;
+	ret = -EFAULT;
+	if (((batch.flags & SCULL_BATCH_TGID) &&
+	     copy_to_user(u64_to_user_ptr(batch.pids), pids,
+			  n * sizeof(*pids))) ||
+	    copy_to_user(u64_to_user_ptr(batch.infos), infos,
+			 n * sizeof(*infos)) ||
+	    copy_to_user(u64_to_user_ptr(batch.errs), errs,
+			 n * sizeof(*errs)) ||
+	    copy_to_user(ubatch, &batch, sizeof(batch)))
+		goto out;
+	ret = 0;
+out:
+	kvfree(errs);
+	kvfree(infos);
+	kvfree(pids);
+	return ret;
+}
+
+/*
+ * debugfs: scull/tasks lists the registry, a line per task with what
+ * SCULL_IOCIQUANTUM would tell it right now (bar the stack address), or
+ * "exited". Being a seq_file, it goes out a page at a time, and each
+ * page walks on from where the last one stopped under an
+ * rcu_read_lock() of its own, so registering never waits for a reader.
+ * A position is a bucket and an index into it, plus one for the header
+ * line, so picking up again is one short walk however big the registry
+ * is. Tasks are only ever appended, so every one that was there when the
+ * read started shows up exactly once.
+ */
+static struct dentry *scull_debugfs;
+
+#define SCULL_TASK_POS(b, i)	(((loff_t)(b) << 32 | (i)) + 1)
+
+/* the first task at or after *pos, which is moved onto it */
+static struct scull_task *scull_task_at(loff_t *pos)
+{
+	u32 b = (*pos - 1) >> 32, i = (*pos - 1) & U32_MAX, n;
+	struct scull_task *t;
+
+	for (; b < 1U << scull_task_bits; b++, i = 0) {
+		n = 0;
+		hlist_for_each_entry_rcu(t, &scull_tasks[b].head, node) {
+			if (n++ == i) {
+				*pos = SCULL_TASK_POS(b, i);
+				return t;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void *scull_tasks_start(struct seq_file *m, loff_t *pos)
+{
+	rcu_read_lock();
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+	return scull_task_at(pos);
+}
+
+static void *scull_tasks_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	/* the next index in the same bucket, or on from the next bucket */
+	(*pos)++;
+	return scull_task_at(pos);
+}
+
+static void scull_tasks_stop(struct seq_file *m, void *v)
+{
+	rcu_read_unlock();
+}
+
+static int scull_tasks_show(struct seq_file *m, void *v)
+{
+	struct scull_task *t = v;
+	struct task_struct *p;
+	struct task_info ti;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_puts(m, "pid tgid state cpu prio static_prio normal_prio "
+				"rt_priority nvcsw nivcsw\n");
+		return 0;
+	}
+	/* registered pids are global ones */
+	p = pid_task(find_pid_ns(t->pid, &init_pid_ns), PIDTYPE_PID);
+	if (!p || p->tgid != t->tgid || p->exit_state) {
+		seq_printf(m, "%d %d exited\n", t->pid, t->tgid);
+		return 0;
+	}
+	scull_task_info(p, &ti);
+	seq_printf(m, "%d %d %ld %u %d %d %d %u %lu %lu\n", ti.pid, ti.tgid,
+			ti.state, ti.cpu, ti.prio, ti.static_prio,
+			ti.normal_prio, ti.rt_priority, ti.nvcsw, ti.nivcsw);
+	return 0;
+}
+
+static const struct seq_operations scull_tasks_sops = {
+	.start	= scull_tasks_start,
+	.next	= scull_tasks_next,
+	.stop	= scull_tasks_stop,
+	.show	= scull_tasks_show,
+};
+
+static int scull_tasks_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &scull_tasks_sops);
+}
+
+static const struct file_operations scull_tasks_fops = {
+	.owner		= THIS_MODULE,
+	.open		= scull_tasks_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
+/*
+ * Sampling, see scull.h
+ *
+ * A delayed work item walks the registry a bucket at a time, each under
+ * an rcu_read_lock() of its own, and rearms itself while scull_sample_ms
+ * is set. It is the only writer of the ring and of the tasks' last-seen
+ * fields, and a work item never runs alongside itself, so neither needs
+ * a lock; readers of the ring only serialise among themselves.
+ */
+static DECLARE_KFIFO_PTR(scull_samples, struct scull_sample);
+static DEFINE_MUTEX(scull_sample_read_lock);	/* readers of the ring */
+static DECLARE_WAIT_QUEUE_HEAD(scull_sample_wq);	/* for records */
+static DEFINE_MUTEX(scull_sample_lock);	/* interval changes */
+static u32 scull_samples_lost;		/* ring full, debugfs */
+
+static void scull_sample_work(struct work_struct *work);
+static DECLARE_DELAYED_WORK(scull_sampler, scull_sample_work);
+
+/* queue t's record for the pass at now, if it still gets one */
+static void scull_sample_task(struct scull_task *t, u64 now)
+{
+	struct scull_sample s = {
+		.time = now,
+		.pid = t->pid,
+		.tgid = t->tgid,
+	};
+	struct task_struct *p;
+	unsigned long nvcsw, nivcsw;
+	int cpu;
+
+	if (t->exited)
+		return;
+	p = pid_task(find_pid_ns(t->pid, &init_pid_ns), PIDTYPE_PID);
+	if (!p || p->tgid != t->tgid || p->exit_state) {
+		t->exited = true;
+		s.flags = SCULL_SAMPLE_EXITED;
+	} else {
+		nvcsw = p->nvcsw;
+		nivcsw = p->nivcsw;
+		cpu = task_cpu(p);
+		if (!t->sampled) {
+			s.flags = SCULL_SAMPLE_FIRST;
+		} else {
+			s.nvcsw = nvcsw - t->nvcsw;
+			s.nivcsw = nivcsw - t->nivcsw;
+			if (cpu != t->cpu)
+				s.flags = SCULL_SAMPLE_MIGRATED;
+		}
+		s.cpu = cpu;
+		s.prio = p->prio;
+		s.state = READ_ONCE(p->state);
+		t->nvcsw = nvcsw;
+		t->nivcsw = nivcsw;
+		t->cpu = cpu;
+		t->sampled = true;
+	}
+	if (!kfifo_put(&scull_samples, s))
+		scull_samples_lost++;
+}
+
+static void scull_sample_work(struct work_struct *work)
+{
+	u64 now = ktime_get_ns();
+	struct scull_task *t;
+	int i, ms;
+
+	for (i = 0; i < 1 << scull_task_bits; i++) {
+		rcu_read_lock();
+		hlist_for_each_entry_rcu(t, &scull_tasks[i].head, node)
+			scull_sample_task(t, now);
+		rcu_read_unlock();
+		cond_resched();
+	}
+	if (!kfifo_is_empty(&scull_samples))
+		wake_up_interruptible(&scull_sample_wq);
+
+	ms = READ_ONCE(scull_sample_ms);
+	if (ms)
+		queue_delayed_work(system_wq, &scull_sampler,
+				msecs_to_jiffies(ms));
+}
+
+/* sample every ms from now on, or stop if 0 */
+static int scull_sample_set(unsigned long ms)
+{
+	if (ms > SCULL_SAMPLE_MAX_MS)
+		return -EINVAL;
+	mutex_lock(&scull_sample_lock);
+	WRITE_ONCE(scull_sample_ms, ms);
+	if (ms)
+		mod_delayed_work(system_wq, &scull_sampler,
+				msecs_to_jiffies(ms));
+	else
+		cancel_delayed_work_sync(&scull_sampler); /* even if rearming */
+	mutex_unlock(&scull_sample_lock);
+	return 0;
+}
+
+/*
+ * Per-open state, in filp->private_data
+ *
+ * Callers that have registered through this file are remembered in a
+ * table indexed by pid, so a repeat SCULL_IOCIQUANTUM from them is one
+ * load and compare, with no lookup, no lock and no store. The table has
+ * as many slots as the registry has buckets, up to
+ * SCULL_FILE_CACHE_BITS_MAX, so even a file shared by thousands of
+ * threads mostly hits; two that collide evict each other, which only
+ * costs a lookup. Registry entries outlive every file, so a slot can't
+ * point at freed memory.
+ */
+#define SCULL_FILE_CACHE_BITS_MAX 16
+
+struct scull_file {
+	unsigned int bits;		/* log2 slots */
+	struct scull_task *cache[];
+};
+
+/* register current through sf, the cheap way when it has before */
+static int scull_file_register(struct scull_file *sf)
+{
+	struct scull_task **slot, *t;
+
+	slot = &sf->cache[hash_32(current->pid, sf->bits)];
+	t = READ_ONCE(*slot);
+	if (t && t->pid == current->pid && t->tgid == current->tgid)
+		return 0;
+
+	t = scull_task_register();
+	if (IS_ERR(t))
+		return PTR_ERR(t);
+	WRITE_ONCE(*slot, t);
+	return 0;
+}
+
 /*
  * Open and close
  */
 
 static int scull_open(struct inode *inode, struct file *filp)
 {
+	struct scull_file *sf;
+	unsigned int bits = min(scull_task_bits, SCULL_FILE_CACHE_BITS_MAX);
+
+	sf = kvzalloc(struct_size(sf, cache, 1 << bits), GFP_KERNEL);
+	if (!sf)
+		return -ENOMEM;
+	sf->bits = bits;
+	filp->private_data = sf;
 	printk(KERN_INFO "scull open\n");
 	return 0;          /* success */
 }
 
 static int scull_release(struct inode *inode, struct file *filp)
 {
+	kvfree(filp->private_data);
 	printk(KERN_INFO "scull close\n");
 	return 0;
 }
 
 
+/*
+ * read: as many whole struct scull_sample records as fit, oldest first
+ */
+static ssize_t scull_read(struct file *filp, char __user *buf, size_t count,
+		loff_t *f_pos)
+{
+	unsigned int copied;
+	int ret;
+
+	if (count < sizeof(struct scull_sample))
+		return -EINVAL;
+	count = rounddown(min_t(size_t, count, INT_MAX),
+			sizeof(struct scull_sample));
+	for (;;) {
+		if (mutex_lock_interruptible(&scull_sample_read_lock))
+			return -ERESTARTSYS;
+		if (!kfifo_is_empty(&scull_samples))
+			break;
+		mutex_unlock(&scull_sample_read_lock);
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(scull_sample_wq,
+				!kfifo_is_empty(&scull_samples)))
+			return -ERESTARTSYS;
+	}
+	ret = kfifo_to_user(&scull_samples, buf, count, &copied);
+	mutex_unlock(&scull_sample_read_lock);
+	return ret ? ret : copied;
+}
+
 /*
  * The ioctl() implementation
  */
@@ -76,8 +592,7 @@ static long scull_ioctl(struct file *filp, unsigned int cmd,
 {
 	int err = 0, tmp;
 	int retval = 0;
-	struct linked_list *node;
-	int flag = 0; /*see if the node in linked list exists */
+	struct task_info output;	/* SCULL_IOCIQUANTUM, per caller */
     	
 	/*
 	 * extract the type and number bitfields, and don't decode
@@ -134,68 +649,30 @@ static long scull_ioctl(struct file *filp, unsigned int cmd,
 		return tmp;
 
 	case SCULL_IOCIQUANTUM: /* Info */
-	
-		mutex_lock(&mutex); /* for concurrency purposes */
-		/* Critical section */
-		if (ll) { /* if you initialize the linked_list */	
-			node = ll;
-			
-		 /* traverse thru the linked list 
-			 see if pid & tgid exist as a pair */
-		do {
-			if ((node->pid)==current->pid){
-				if ((node->tgid)==current->tgid){
-					flag = -1;
-					break;		
-				}	       
-			}
-			if (node->next){
-				node = node->next;
-			} else {
-				break;
-			}
-
-		} while (node->next);
-		/*the linked list part -- basically only adding to the tail part */
-		if(flag==0) { /*when flag is not used, then it can add to linked list */ 
-			node->next = kmalloc(sizeof(struct linked_list), GFP_KERNEL); /*tail */
-			node->next->next = NULL; /* fix weird segfault */
-			node->next->prev = node; /*points back to current node-previous tail*/
-			node->next->pid = current->pid; /*gets pid of tail*/
-			node->next->tgid = current->tgid; /*gets tgid of tail*/
-		}
-	} else { /*instantiate linked list*/
-		ll = kmalloc(sizeof(struct linked_list),GFP_KERNEL);
-		ll->next = NULL;
-		ll->prev = NULL;
-		ll->pid = current->pid;
-		ll->tgid = current->tgid;
-		
-	}
-		mutex_unlock(&mutex);
+		retval = scull_file_register(filp->private_data);
+		if (retval)
+			break;
 		/* using the macro 'current', assign values to the 
 		 * struct task_info 
 		 * put_user() -- copies single interger
 		 * copy_to_user() -- used to copy structure/bytes
 		 * */
-		output.state = current->state;
-		output.stack = current->stack;
-		output.cpu = current->cpu;
-		output.prio = current->prio;
-		output.static_prio = current->static_prio;
-		output.normal_prio = current->normal_prio;
-		output.rt_priority = current->rt_priority;
-		output.pid = current->pid;
-		output.tgid = current->tgid;
-		output.nvcsw = current->nvcsw;
-		output.nivcsw = current->nivcsw;
+		memset(&output, 0, sizeof(output)); /* padding included */
+		scull_task_info(current, &output);
 		/* this will copy the data from kernel (driver) to user(src) 
 		 * copy_to_user(to, from, n)
 		 * copy into memory address
 		 * */
-		retval = copy_to_user((int __user *) arg, &output, sizeof(output));
+		if (copy_to_user((int __user *) arg, &output, sizeof(output)))
+			retval = -EFAULT;
 		break;
 
+	case SCULL_IOCBINFO: /* Batch: arg points to a struct scull_task_batch */
+		return scull_batch_info((struct scull_task_batch __user *)arg);
+
+	case SCULL_IOCTSAMPLE: /* Tell: arg is the interval in ms, 0 stops */
+		return scull_sample_set(arg);
+
 	default:  /* redundant, as cmd was checked against MAXNR */
 		return -ENOTTY;
 	}
@@ -207,6 +684,7 @@ static long scull_ioctl(struct file *filp, unsigned int cmd,
 struct file_operations scull_fops = {
 	.owner =    THIS_MODULE,
 	.unlocked_ioctl = scull_ioctl,
+	.read =     scull_read,
 	.open =     scull_open,
 	.release =  scull_release,
 };
@@ -224,23 +702,17 @@ struct file_operations scull_fops = {
  * step 2: free the traversal
  */
 void scull_cleanup_module(void){		
-	int count = 1;
-	struct linked_list* node = ll;
-	struct linked_list* tmp; /* by creating a tmp variable, node wont have to be NULL */
-	/*traversal part again*/
-	while(node != NULL) {
-		printk(KERN_INFO "Task %d: PID %d, TGID %d\n", count++, node->pid, node->tgid);
-		tmp = node;
-			node = node->next;
-		kfree(tmp);
-	}
-	
-
 	dev_t devno = MKDEV(scull_major, scull_minor);
 
 	/* Get rid of the char dev entry */
 	cdev_del(&scull_cdev);
 
+	/* readers of scull/tasks and the sampler walk the registry */
+	debugfs_remove_recursive(scull_debugfs);
+	scull_sample_set(0);
+	kfifo_free(&scull_samples);
+	scull_tasks_free();
+
 	/* cleanup_module is never called if registering failed */
 	unregister_chrdev_region(devno, 1);
 	
@@ -253,6 +725,13 @@ int scull_init_module(void)
 	int result;
 	dev_t dev = 0;
 
+	if (scull_task_bits < 1 || scull_task_bits > SCULL_TASK_BITS_MAX ||
+	    scull_sample_ms < 0 || scull_sample_ms > SCULL_SAMPLE_MAX_MS ||
+	    scull_sample_ring < 1) {
+		printk(KERN_WARNING "scull: bad registry or sampling parameters\n");
+		return -EINVAL;
+	}
+
 	/*
 	 * Get a range of minor numbers to work with, asking for a dynamic
 	 * major unless directed otherwise at load time.
@@ -269,6 +748,25 @@ int scull_init_module(void)
 		return result;
 	}
 
+	result = scull_tasks_alloc();
+	if (!result) {
+		/* rounded up to a power of 2 */
+		result = kfifo_alloc(&scull_samples, scull_sample_ring,
+				GFP_KERNEL);
+		if (result)
+			scull_tasks_free();
+	}
+	if (result) {
+		unregister_chrdev_region(dev, 1);
+		return result;
+	}
+	/* no registry file is no reason to fail */
+	scull_debugfs = debugfs_create_dir("scull", NULL);
+	debugfs_create_file("tasks", 0444, scull_debugfs, NULL,
+			&scull_tasks_fops);
+	debugfs_create_u32("samples_lost", 0444, scull_debugfs,
+			&scull_samples_lost);
+
 	cdev_init(&scull_cdev, &scull_fops);
 	scull_cdev.owner = THIS_MODULE;
 	result = cdev_add (&scull_cdev, dev, 1);
@@ -278,6 +776,8 @@ int scull_init_module(void)
 		goto fail;
 	}
 
+	if (scull_sample_ms)
+		scull_sample_set(scull_sample_ms);
 	return 0; /* succeed */
 
   fail:
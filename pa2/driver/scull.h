@@ -19,6 +19,7 @@
 #define _SCULL_H_
 
 #include <linux/ioctl.h> /* needed for the _IOW etc stuff used later */
+#include <linux/types.h> /* __u32 etc for struct scull_task_batch */
 
 
 #ifndef SCULL_MAJOR
@@ -33,6 +34,29 @@
 #define SCULL_QUANTUM 4000
 #endif
 
+/*
+ * SCULL_TASK_BITS - the task registry has 1 << scull_task_bits hash
+ * buckets, at most 1 << SCULL_TASK_BITS_MAX; size it to about as many
+ * tasks as will register, and every lookup stays a short walk
+ */
+#ifndef SCULL_TASK_BITS
+#define SCULL_TASK_BITS 10
+#endif
+#define SCULL_TASK_BITS_MAX 20
+
+/*
+ * Sampling - every scull_sample_ms (0: off, the default; SCULL_IOCTSAMPLE
+ * changes it) the driver looks at every registered task and queues a
+ * struct scull_sample for each in a ring of scull_sample_ring records.
+ * read() takes as many whole records as fit, and blocks while there are
+ * none unless O_NONBLOCK. When readers fall behind, new records are lost
+ * and counted in scull/samples_lost in debugfs.
+ */
+#ifndef SCULL_SAMPLE_RING
+#define SCULL_SAMPLE_RING 4096
+#endif
+#define SCULL_SAMPLE_MAX_MS 3600000
+
 
 /*
  * Ioctl definitions
@@ -55,14 +79,53 @@ struct task_info {
 	unsigned long nivcsw;
 };
 
-struct linked_list{
-	struct linked_list* next;
-	struct linked_list* prev;
-	pid_t pid;
-	pid_t tgid;
+/*
+ * SCULL_IOCBINFO: struct task_info for many tasks in one call. pids,
+ * infos and errs point to arrays of nr entries each. Either pids holds
+ * the pids to look at, or, with SCULL_BATCH_TGID, the threads of process
+ * tgid are reported and their pids written there. On return nr is the
+ * number of entries filled in and total the number there were (more than
+ * nr if the arrays were too short for all of a process's threads).
+ * errs[i] is 0, -ESRCH for a task that has exited or -EPERM for one the
+ * caller may not ptrace-read; infos[i] is left zeroed for both. stack is
+ * only ever filled in for the caller itself. At most SCULL_BATCH_MAX
+ * entries per call.
+ */
+struct scull_task_batch {
+	__u32 nr;		/* in: room in the arrays, out: filled */
+	__u32 flags;		/* SCULL_BATCH_* */
+	__s32 tgid;		/* with SCULL_BATCH_TGID */
+	__u32 total;		/* out */
+	__u64 pids;		/* pid_t *, in or, with SCULL_BATCH_TGID, out */
+	__u64 infos;		/* struct task_info *, out */
+	__u64 errs;		/* __s32 *, out */
+};
 
+#define SCULL_BATCH_TGID 0x1	/* all threads of tgid */
+#define SCULL_BATCH_MAX  8192
+
+/*
+ * One task at one sampling pass. The counts are since the task's
+ * previous sample; on its first they are 0 and SCULL_SAMPLE_FIRST is set.
+ * A task that has exited gets one last record with SCULL_SAMPLE_EXITED
+ * and the other fields 0, and no more after that.
+ */
+struct scull_sample {
+	__u64 time;		/* of the pass, CLOCK_MONOTONIC ns */
+	__s32 pid;
+	__s32 tgid;
+	__u32 nvcsw;		/* voluntary context switches */
+	__u32 nivcsw;		/* involuntary ones */
+	__u16 cpu;
+	__s16 prio;
+	__u16 state;		/* task state bits, 0 is running */
+	__u16 flags;		/* SCULL_SAMPLE_* */
 };
 
+#define SCULL_SAMPLE_FIRST    0x1	/* first sample of this task */
+#define SCULL_SAMPLE_MIGRATED 0x2	/* on another cpu than last time */
+#define SCULL_SAMPLE_EXITED   0x4
+
 /* Use 'k' as magic number */
 #define SCULL_IOC_MAGIC  'k'
 #define SCULL_IOCRESET    _IO(SCULL_IOC_MAGIC, 0)
@@ -75,6 +138,8 @@ struct linked_list{
  * X means "eXchange": switch G and S atomically
  * H means "sHift": switch T and Q atomically
  * i means "info"
+ * B means "Batch": info for many tasks at once
+ * TSAMPLE tells the sampling interval in ms, 0 to stop
  */
 #define SCULL_IOCSQUANTUM _IOW(SCULL_IOC_MAGIC,  1, int)
 #define SCULL_IOCTQUANTUM _IO(SCULL_IOC_MAGIC,   2)
@@ -86,9 +151,11 @@ struct linked_list{
 /*
  * it accepts a struct of a task_info struct
  */
+#define SCULL_IOCBINFO    _IOWR(SCULL_IOC_MAGIC, 8, struct scull_task_batch)
+#define SCULL_IOCTSAMPLE  _IO(SCULL_IOC_MAGIC,   9)
 
 /* ... more to come */
 
-#define SCULL_IOC_MAXNR 7 /*change it to 7 since we added 'I' case */
+#define SCULL_IOC_MAXNR 9
 
 #endif /* _SCULL_H_ */
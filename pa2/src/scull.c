@@ -3,16 +3,25 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
 #include "scull.h"
 #include <pthread.h>
+#include <stdint.h>
 
 #define CDEV_NAME "/dev/scull"
 
 /* Quantum command line option */
 static int g_quantum;
+/* Batch command line options: the pids, or the tgid */
+static pid_t g_pids[SCULL_BATCH_MAX];
+static int g_nr_pids;
+static pid_t g_tgid;
+/* Sample command line options: the interval and how many records */
+static int g_sample_ms;
+static int g_nr_samples;
 
 static void usage(const char *cmd)
 {
@@ -27,6 +36,9 @@ static void usage(const char *cmd)
 	       "  H <int>    Shift quantum\n"
 	       "  h          Print this message\n"
 	       "  i          Get Info of Process\n"
+	       "  b <pid>... Get Info of every <pid> in one call\n"
+	       "  g <tgid>   Get Info of every thread of process <tgid>\n"
+	       "  m <ms> <n> Sample registered tasks every <ms>, print <n> records\n"
 	       "  p 	     Print process\n",
 	       cmd);
 }
@@ -57,6 +69,32 @@ static cmd_t parse_arguments(int argc, const char **argv)
 		}
 		g_quantum = atoi(argv[2]);
 		break;
+	case 'b':
+		if (argc < 3 || argc - 2 > SCULL_BATCH_MAX) {
+			fprintf(stderr, "%s: Missing or too many pids\n", argv[0]);
+			cmd = -1;
+			break;
+		}
+		for (g_nr_pids = 0; g_nr_pids < argc - 2; g_nr_pids++)
+			g_pids[g_nr_pids] = atoi(argv[g_nr_pids + 2]);
+		break;
+	case 'g':
+		if (argc < 3) {
+			fprintf(stderr, "%s: Missing tgid\n", argv[0]);
+			cmd = -1;
+			break;
+		}
+		g_tgid = atoi(argv[2]);
+		break;
+	case 'm':
+		if (argc < 4) {
+			fprintf(stderr, "%s: Missing interval or count\n", argv[0]);
+			cmd = -1;
+			break;
+		}
+		g_sample_ms = atoi(argv[2]);
+		g_nr_samples = atoi(argv[3]);
+		break;
 	case 'R':
 	case 'G':
 	case 'Q':
@@ -90,6 +128,73 @@ void* print_threads (void* arg) {
 
 }
 
+/* Info on g_pids, or on every thread of g_tgid, with one ioctl */
+static int do_batch(int fd, cmd_t cmd)
+{
+	static struct task_info infos[SCULL_BATCH_MAX];
+	static __s32 errs[SCULL_BATCH_MAX];
+	struct scull_task_batch b = {
+		.nr = g_nr_pids,
+		.pids = (uintptr_t)g_pids,
+		.infos = (uintptr_t)infos,
+		.errs = (uintptr_t)errs,
+	};
+	struct task_info *t;
+	unsigned int i;
+	int ret;
+
+	if (cmd == 'g') {
+		b.nr = SCULL_BATCH_MAX;
+		b.flags = SCULL_BATCH_TGID;
+		b.tgid = g_tgid;
+	}
+	ret = ioctl(fd, SCULL_IOCBINFO, &b);
+	if (ret != 0)
+		return ret;
+
+	for (i = 0; i < b.nr; i++) {
+		t = &infos[i];
+		if (errs[i]) {
+			printf("pid %d: %s\n", g_pids[i], strerror(-errs[i]));
+			continue;
+		}
+		printf("state %ld, stack %p, cpu %u, prio %d, sprio %d, nprio %d, rtprio %u, pid %d, tgid %d, nv %lu, niv %lu\n", t->state, t->stack, t->cpu, t->prio, t->static_prio, t->normal_prio, t->rt_priority, t->pid, t->tgid, t->nvcsw, t->nivcsw);
+	}
+	if (b.total > b.nr)
+		printf("%u more threads not shown\n", b.total - b.nr);
+	return 0;
+}
+
+/* Sample every g_sample_ms until g_nr_samples records are printed */
+static int do_sample(int fd)
+{
+	struct scull_sample s[64];
+	ssize_t n;
+	int i, ret;
+
+	ret = ioctl(fd, SCULL_IOCTSAMPLE, g_sample_ms);
+	if (ret != 0)
+		return ret;
+
+	while (g_nr_samples > 0) {
+		n = read(fd, s, sizeof(s));
+		if (n < 0) {
+			perror("read");
+			break;
+		}
+		for (i = 0; i < n / (ssize_t)sizeof(s[0]) && g_nr_samples > 0;
+		     i++, g_nr_samples--)
+			printf("time %llu, pid %d, tgid %d, cpu %u, prio %d, state %u, nv +%u, niv +%u%s%s%s\n",
+			       (unsigned long long)s[i].time, s[i].pid, s[i].tgid,
+			       s[i].cpu, s[i].prio, s[i].state, s[i].nvcsw,
+			       s[i].nivcsw,
+			       s[i].flags & SCULL_SAMPLE_FIRST ? ", first" : "",
+			       s[i].flags & SCULL_SAMPLE_MIGRATED ? ", migrated" : "",
+			       s[i].flags & SCULL_SAMPLE_EXITED ? ", exited" : "");
+	}
+	return ioctl(fd, SCULL_IOCTSAMPLE, 0);
+}
+
 static int do_op(int fd, cmd_t cmd)
 {
 	pid_t pid;
@@ -168,6 +273,13 @@ static int do_op(int fd, cmd_t cmd)
 		}
 		ret = 0;
 		break;
+	case 'b':
+	case 'g':
+		ret = do_batch(fd, cmd);
+		break;
+	case 'm':
+		ret = do_sample(fd);
+		break;
 	case 't':
 	/*create 4 threads and helper function is applied to the pthread_create
 	 * pthread_create (thread, attr, *start_routine, arg)
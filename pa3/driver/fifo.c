@@ -0,0 +1,1702 @@
+/*
+ * fifo.c -- the FIFO rings behind the scull devices
+ *
+ * Copyright (C) 2001 Alessandro Rubini and Jonathan Corbet
+ * Copyright (C) 2001 O'Reilly & Associates
+ *
+ * The source code in this file can be freely used, adapted,
+ * and redistributed in source or binary form, so long as an
+ * acknowledgment appears in derived source files.  The citation
+ * should list that the code comes from the book "Linux Device
+ * Drivers" by Alessandro Rubini and Jonathan Corbet, published
+ * by O'Reilly & Associates.   No warranty is attached;
+ * we cannot take responsibility for errors or fitness for use.
+ *
+ */
+
+#include "scull_fifo.h"		/* local definitions */
+
+/*
+ * Statistics
+ */
+
+static void scull_stat_occupancy(struct scull_dev *dev, u64 n)
+{
+	/* racy against preemption, but then this is only a statistic */
+	if (n > this_cpu_read(dev->stats->max_occupancy))
+		this_cpu_write(dev->stats->max_occupancy, n);
+}
+
+/* an element queued since stamp is being handed out at now */
+static inline void scull_stat_residence(struct scull_dev *dev, u64 stamp,
+		u64 now)
+{
+	scull_stat_inc(dev, residence_ns[scull_hist_bucket(now - stamp)]);
+}
+
+void scull_stats_sum(struct scull_dev *dev, struct scull_stats *sum)
+{
+	int cpu;
+	size_t i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		struct scull_stats *st = per_cpu_ptr(dev->stats, cpu);
+		const u64 *from = (const u64 *)st;
+		u64 max = max(sum->max_occupancy, st->max_occupancy);
+
+		/* every field is a u64 that adds up, except the maximum */
+		for (i = 0; i < sizeof(*sum) / sizeof(u64); i++)
+			((u64 *)sum)[i] += from[i];
+		sum->max_occupancy = max;
+	}
+}
+
+/* down(&dev->sem), counting the times it had to sleep */
+static int scull_lock(struct scull_dev *dev)
+{
+	u64 t0;
+	int ret;
+
+	if (!down_trylock(&dev->sem))
+		return 0;
+	t0 = ktime_get_ns();
+	ret = down_interruptible(&dev->sem);
+	scull_stat_wait(dev, sem, t0);
+	return ret;
+}
+
+/*
+ * Slots
+ *
+ * A slot ring of size slots is one allocation, laid out as
+ * scull_fifo_layout says (see SCULL_LAYOUT_* in scull.h): slot i's header
+ * is i header strides in, its payload scull_data_off() + i slot strides
+ * in. For PACKED the two strides are the same and the payload just
+ * follows its header; for SPLIT the headers are an array at the front and
+ * the payloads start on a fresh cache line after it.
+ */
+static inline bool scull_split(void)
+{
+	return scull_fifo_layout == SCULL_LAYOUT_SPLIT;
+}
+
+/* from one slot's payload to the next */
+static inline size_t scull_slot_size(void)
+{
+	if (scull_split())
+		return ALIGN(scull_fifo_elemsz, SCULL_CACHELINE);
+	/* keep every header's stamp 8-byte aligned */
+	return ALIGN(sizeof(struct scull_elem_hdr) + scull_fifo_elemsz, 8);
+}
+
+/* from one slot's header to the next */
+static inline size_t scull_hdr_size(void)
+{
+	return scull_split() ? sizeof(struct scull_elem_hdr) : scull_slot_size();
+}
+
+/* where the payload of slot 0 starts */
+static inline size_t scull_data_off(int size)
+{
+	if (scull_split())
+		return ALIGN((size_t)size * sizeof(struct scull_elem_hdr),
+				SCULL_CACHELINE);
+	return sizeof(struct scull_elem_hdr);
+}
+
+/* bytes a ring of size slots takes */
+static inline size_t scull_slots_bytes(int size)
+{
+	size_t bytes = (size_t)size * scull_slot_size();
+
+	return scull_split() ? scull_data_off(size) + bytes : bytes;
+}
+
+static inline struct scull_elem_hdr *scull_hdr(char *arr, unsigned long idx)
+{
+	return (struct scull_elem_hdr *)(arr + idx * scull_hdr_size());
+}
+
+static inline char *scull_data(char *arr, int size, unsigned long idx)
+{
+	return arr + scull_data_off(size) + idx * scull_slot_size();
+}
+
+/*
+ * Fragmentation: with scull_fifo_msgsz above elemsz, an element of the
+ * locked ring takes scull_msg_slots() slots in a row, see scull.h. Only
+ * the first slot's header is used.
+ */
+size_t scull_msg_max(void)
+{
+	return max(scull_fifo_msgsz, scull_fifo_elemsz);
+}
+
+static inline bool scull_fragmenting(void)
+{
+	return scull_fifo_msgsz > scull_fifo_elemsz;
+}
+
+/* slots an element of len bytes takes */
+static inline int scull_msg_slots(size_t len)
+{
+	return max_t(int, DIV_ROUND_UP(len, scull_fifo_elemsz), 1);
+}
+
+/* put what fmt asks for in front of a payload of len bytes */
+static int scull_hdr_out(struct iov_iter *to, const struct scull_elem_hdr *hdr,
+		__u32 len, u64 now, unsigned int fmt)
+{
+	struct scull_stamp st = {
+		.enqueued = hdr->stamp,
+		.residence = now - hdr->stamp,
+	};
+
+	if ((fmt & SCULL_GET_STAMPED) &&
+	    copy_to_iter(&st, sizeof(st), to) != sizeof(st))
+		return -EFAULT;
+	if ((fmt & SCULL_GET_FRAMED) &&
+	    copy_to_iter(&len, SCULL_FRAME_HDR, to) != SCULL_FRAME_HDR)
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Copy one element of len bytes out to the reader, after the headers fmt
+ * asks for. A payload longer than the room left is truncated, like read()
+ * does. len is what the caller checked, never hdr->len again: a mapper
+ * can change that under us.
+ */
+static ssize_t scull_copy_elem_out(struct scull_dev *dev, struct iov_iter *to,
+		struct scull_elem_hdr *hdr, __u32 len, char *data,
+		unsigned int fmt)
+{
+	size_t room = iov_iter_count(to) - scull_out_hdr(fmt);
+	u64 now = ktime_get_ns();
+
+	if (len > room)
+		len = room;
+	if (scull_hdr_out(to, hdr, len, now, fmt) ||
+	    copy_to_iter(data, len, to) != len)
+		return -EFAULT;
+	scull_stat_residence(dev, hdr->stamp, now);
+	return scull_out_hdr(fmt) + len;
+}
+
+/*
+ * Copy count bytes from the writer into a slot and stamp it; anything
+ * past elemsz is consumed but dropped, like write() does. Returns the
+ * stored length, which the caller puts in the header.
+ */
+static ssize_t scull_copy_elem_in(struct scull_elem_hdr *hdr, char *data,
+		struct iov_iter *from, size_t count)
+{
+	size_t len = min_t(size_t, count, scull_fifo_elemsz);
+
+	if (copy_from_iter(data, len, from) != len)
+		return -EFAULT;
+	iov_iter_advance(from, count - len);
+	hdr->stamp = ktime_get_ns();
+	return len;
+}
+
+/*
+ * Lock-free mode.
+ *
+ * full/empty already bound how many readers and writers can be past the
+ * semaphore at once, so a position can be taken with a plain fetch-and-add
+ * instead of a CAS loop. The slot at that position may still be in use by
+ * the other side (a slower reader on the previous lap, or a writer that
+ * has not published yet), so wait for its sequence number to catch up.
+ * That wait is only ever as long as one copy_*_user of the other side,
+ * unless the other side is a mapper that died or scribbled over seq[]
+ * in between. So a fatal signal ends it with -EINTR: the position is
+ * then lost, and everyone after it on that slot waits (killably) until
+ * SCULL_IOCSETSIZE rebuilds seq[] from head and tail.
+ */
+static int scull_slot_wait(struct scull_dev *dev, unsigned long idx,
+		u64 seq)
+{
+	while (smp_load_acquire(&dev->seq[idx]) != seq) {
+		if (fatal_signal_pending(current))
+			return -EINTR;
+		cpu_relax();
+		cond_resched();
+	}
+	return 0;
+}
+
+/*
+ * Busy-polling. Before a caller goes to sleep for an element or for room,
+ * it can spin on the same condition for up to the device's spin window
+ * (SCULL_IOCSSPIN), like SO_BUSY_POLL does for sockets: when the other
+ * side is only a little behind, that is much cheaper than a sleep, a
+ * wakeup and two context switches. A spinner isn't on the wait queue yet,
+ * so the giver doesn't need to wake it either. Evaluates to true if
+ * condition came true while spinning; it must take what it tests for, as
+ * in wait_event().
+ */
+#define scull_spin(dev, condition) ({					\
+	u64 __window = READ_ONCE((dev)->spin_ns);			\
+	bool __got = false;						\
+	if (__window) {							\
+		u64 __end = ktime_get_ns() + __window;			\
+		do {							\
+			if (condition) {				\
+				__got = true;				\
+				break;					\
+			}						\
+			cpu_relax();					\
+		} while (ktime_get_ns() < __end && !need_resched());	\
+		if (__got)						\
+			scull_stat_inc(dev, spin_hits);			\
+		else							\
+			scull_stat_inc(dev, spin_misses);		\
+	}								\
+	__got;								\
+})
+
+/*
+ * full/empty: counting semaphores kept in ctl. In lock-free mode user
+ * space takes and gives them directly in the mapped control page, see
+ * scull.h. Sleepers advertise themselves in *waiters so that mappers know
+ * to wake them; the driver's own givers just look at the wait queue, which
+ * also has the pollers on it.
+ */
+static int scull_credit_take(struct scull_dev *dev, atomic_t *credits,
+		atomic_t *waiters, wait_queue_head_t *wq, bool block,
+		u64 __percpu *waits, u64 __percpu *wait_ns)
+{
+	u64 t0;
+	int ret;
+
+	if (atomic_dec_if_positive(credits) >= 0)
+		return 0;
+	if (!block)
+		return -EAGAIN;
+	if (scull_spin(dev, atomic_dec_if_positive(credits) >= 0))
+		return 0;
+
+	atomic_inc(waiters);
+	smp_mb__after_atomic(); /* pairs with the barrier in scull_credit_give */
+	t0 = ktime_get_ns();
+	ret = wait_event_interruptible_exclusive(*wq,
+			atomic_dec_if_positive(credits) >= 0);
+	this_cpu_inc(*waits);
+	this_cpu_add(*wait_ns, ktime_get_ns() - t0);
+	atomic_dec(waiters);
+	return ret;
+}
+
+static void scull_credit_give(atomic_t *credits, int n,
+		wait_queue_head_t *wq, __poll_t events)
+{
+	atomic_add(n, credits);
+	smp_mb__after_atomic(); /* pairs with set_current_state() in the waiter */
+	if (waitqueue_active(wq))
+		wake_up_interruptible_poll(wq, events);
+}
+
+/* take n credits at once, or none */
+static bool scull_credits_sub(atomic_t *credits, int n)
+{
+	int old = atomic_read(credits), cur;
+
+	while (old >= n) {
+		cur = atomic_cmpxchg(credits, old, old - n);
+		if (cur == old)
+			return true;
+		old = cur;
+	}
+	return false;
+}
+
+int scull_full_take(struct scull_dev *dev, bool block)
+{
+	return scull_credit_take(dev, &dev->ctl->full, &dev->ctl->full_waiters,
+			&dev->full_wq, block, &dev->stats->full_waits,
+			&dev->stats->full_wait_ns);
+}
+
+static void scull_full_give(struct scull_dev *dev)
+{
+	scull_credit_give(&dev->ctl->full, 1, &dev->full_wq, EPOLLIN | EPOLLRDNORM);
+}
+
+int scull_empty_take(struct scull_dev *dev, bool block)
+{
+	return scull_credit_take(dev, &dev->ctl->empty, &dev->ctl->empty_waiters,
+			&dev->empty_wq, block, &dev->stats->empty_waits,
+			&dev->stats->empty_wait_ns);
+}
+
+static void scull_empty_give(struct scull_dev *dev)
+{
+	scull_credit_give(&dev->ctl->empty, 1, &dev->empty_wq,
+			EPOLLOUT | EPOLLWRNORM);
+}
+
+/*
+ * n empty credits at once, for the byte ring and fragmented elements.
+ * Such writers wait non-exclusively, so every give wakes them all.
+ */
+static int scull_empty_take_n(struct scull_dev *dev, int n, bool block)
+{
+	u64 t0;
+	int ret;
+
+	if (scull_credits_sub(&dev->ctl->empty, n))
+		return 0;
+	if (!block)
+		return -EAGAIN;
+	if (scull_spin(dev, scull_credits_sub(&dev->ctl->empty, n)))
+		return 0;
+	/* writers need different amounts, so each one rechecks on every wake */
+	t0 = ktime_get_ns();
+	ret = wait_event_interruptible(dev->empty_wq,
+			scull_credits_sub(&dev->ctl->empty, n));
+	scull_stat_wait(dev, empty, t0);
+	return ret;
+}
+
+static void scull_empty_give_n(struct scull_dev *dev, int n)
+{
+	scull_credit_give(&dev->ctl->empty, n, &dev->empty_wq,
+			EPOLLOUT | EPOLLWRNORM);
+}
+
+/*
+ * Consume one element, or fail with -EAGAIN instead of sleeping if !block.
+ * With more == true this is a follow-up element of a framed read: leave
+ * the element alone (-EMSGSIZE) unless it fits whole. Lock-free mode
+ * can't look at an element before claiming it, so there that means leaving
+ * room for a full elemsz.
+ */
+static ssize_t scull_get_lockfree(struct scull_dev *dev, struct iov_iter *to,
+		unsigned int fmt, bool more, bool block)
+{
+	struct scull_elem_hdr *hdr;
+	u64 pos;
+	unsigned long idx;
+	ssize_t ret;
+	int len, err;
+
+	if (more && iov_iter_count(to) < scull_out_hdr(fmt) + scull_fifo_elemsz)
+		return -EMSGSIZE;
+
+	for (;;) {
+		err = scull_full_take(dev, block);
+		if (err)
+			return err;
+
+		percpu_down_read(&dev->resize_rwsem);
+		pos = atomic64_inc_return(&dev->ctl->head) - 1;
+		idx = pos % dev->size;
+		hdr = scull_hdr(dev->FIFO_arr, idx);
+		err = scull_slot_wait(dev, idx, pos + 1);
+		if (err) {
+			percpu_up_read(&dev->resize_rwsem);
+			return err;
+		}
+
+		len = READ_ONCE(hdr->len);
+		if (len >= 0 && len <= scull_fifo_elemsz)
+			break;
+		/*
+		 * Nothing usable in there (poisoned, or garbage from a mapper):
+		 * hand the slot back and wait for the next.
+		 */
+		smp_store_release(&dev->seq[idx], pos + dev->size);
+		percpu_up_read(&dev->resize_rwsem);
+		scull_empty_give(dev);
+	}
+
+	/* the element is consumed even if the copy faults */
+	ret = scull_copy_elem_out(dev, to, hdr, len,
+			scull_data(dev->FIFO_arr, dev->size, idx), fmt);
+
+	smp_store_release(&dev->seq[idx], pos + dev->size);
+	percpu_up_read(&dev->resize_rwsem);
+	scull_empty_give(dev);
+	return ret;
+}
+
+static ssize_t scull_put_lockfree(struct scull_dev *dev, struct iov_iter *from,
+		size_t count, bool block)
+{
+	struct scull_elem_hdr *hdr;
+	u64 pos;
+	unsigned long idx;
+	ssize_t ret;
+	int err;
+
+	err = scull_empty_take(dev, block);
+	if (err)
+		return err;
+
+	percpu_down_read(&dev->resize_rwsem);
+	pos = atomic64_inc_return(&dev->ctl->tail) - 1;
+	idx = pos % dev->size;
+	hdr = scull_hdr(dev->FIFO_arr, idx);
+	err = scull_slot_wait(dev, idx, pos);
+	if (err) {
+		percpu_up_read(&dev->resize_rwsem);
+		return err;
+	}
+
+	/*
+	 * The position is ours now and readers will wait for it, so a fault
+	 * cannot simply give it back: publish it poisoned instead.
+	 */
+	ret = scull_copy_elem_in(hdr, scull_data(dev->FIFO_arr, dev->size, idx),
+			from, count);
+	hdr->len = ret < 0 ? SCULL_SLOT_POISON : ret;
+
+	smp_store_release(&dev->seq[idx], pos + 1);
+	percpu_up_read(&dev->resize_rwsem);
+	scull_full_give(dev);
+	return ret;
+}
+
+/*
+ * An element's payload, len bytes of it, out of or into the slots it
+ * runs through from idx on. Return how much got copied.
+ */
+static size_t scull_frags_out(struct scull_dev *dev, unsigned long idx,
+		size_t len, struct iov_iter *to)
+{
+	size_t n, done;
+
+	for (done = 0; done < len; done += n, idx = (idx + 1) % dev->size) {
+		n = min_t(size_t, len - done, scull_fifo_elemsz);
+		if (copy_to_iter(scull_data(dev->FIFO_arr, dev->size, idx), n,
+				 to) != n)
+			break;
+	}
+	return done;
+}
+
+static size_t scull_frags_in(struct scull_dev *dev, unsigned long idx,
+		size_t len, struct iov_iter *from)
+{
+	size_t n, done;
+
+	for (done = 0; done < len; done += n, idx = (idx + 1) % dev->size) {
+		n = min_t(size_t, len - done, scull_fifo_elemsz);
+		if (copy_from_iter(scull_data(dev->FIFO_arr, dev->size, idx), n,
+				   from) != n)
+			break;
+	}
+	return done;
+}
+
+/* consumes one element*/
+static ssize_t scull_get_locked(struct scull_dev *dev, struct iov_iter *to,
+		unsigned int fmt, bool more, bool block)
+{
+	/* copy(read from file) bytes of next full element into buf
+	 * return the number of bytes copied as result < size of next elem
+	 * if count < size of next full elem in FIFO - count bytes copied into buf is not used
+	 * if no elements in array to consume - return error if copy fails
+	 * compare to len instead of scull_fifo_elemsz
+	 */
+	
+	// count is what user inputs
+	/* check if count is smaller than the size of the next full elem */
+	
+	// Using slide 20 of Concurrency Part 2 :) and links in that same slide 
+	// pls be kind :)
+	size_t room = iov_iter_count(to) - scull_out_hdr(fmt);
+	struct scull_elem_hdr *hdr;
+	unsigned long start;
+	__u32 len, n;
+	u64 now;
+	ssize_t ret;
+
+	ret = scull_full_take(dev, block);
+	if (ret)
+		return ret;
+	if (scull_lock(dev)) {
+		scull_full_give(dev);
+		return -ERESTARTSYS;
+	}
+
+	start = atomic64_read(&dev->ctl->head) % dev->size;
+	hdr = scull_hdr(dev->FIFO_arr, start);
+	len = hdr->len;
+	if (more && room < len) {
+		up(&dev->sem);
+		scull_full_give(dev);
+		return -EMSGSIZE;
+	}
+
+	/* copy_to_iter - returns number of bytes that could be copied
+	 * on failure the element stays at start for the next reader
+	 */
+	n = min_t(size_t, len, room);
+	now = ktime_get_ns();
+	if (scull_hdr_out(to, hdr, n, now, fmt) ||
+	    scull_frags_out(dev, start, n, to) != n) {
+		up(&dev->sem);
+		scull_full_give(dev);
+		return -EFAULT;
+	}
+	scull_stat_residence(dev, hdr->stamp, now);
+	// move past the element's slots; head wraps when taken modulo size
+	atomic64_add(scull_msg_slots(len), &dev->ctl->head);
+	up(&dev->sem);
+	scull_empty_give_n(dev, scull_msg_slots(len));
+	return scull_out_hdr(fmt) + n;
+}
+
+/* produce one element */
+static ssize_t scull_put_locked(struct scull_dev *dev, struct iov_iter *from,
+		size_t count, bool block)
+{
+	/* copy count bytes from buf into next empty FIFO element
+	 *    return # of bytes copied as result - < than ELEMSZ
+	 * if count > ELEMSZ then only ELEMSZ are copied, or up to
+	 * scull_msg_max() over several slots when fragmenting
+	 * else count is copied 
+	 * block if no space in the array to consume
+	 * error if copying fails 
+	 */
+	size_t len = min_t(size_t, count, scull_msg_max());
+	int slots = scull_msg_slots(len);
+	struct scull_elem_hdr *hdr;
+	unsigned long end;
+	ssize_t ret;
+
+	/* all slots or none, and only committed once they are all filled */
+	if (scull_fragmenting())
+		ret = scull_empty_take_n(dev, slots, block);
+	else
+		ret = scull_empty_take(dev, block);
+	if (ret)
+		return ret;
+	if (scull_lock(dev)) {
+		scull_empty_give_n(dev, slots);
+		return -ERESTARTSYS;
+	}
+
+	end = atomic64_read(&dev->ctl->tail) % dev->size;
+	if (scull_frags_in(dev, end, len, from) != len) {
+		up(&dev->sem);
+		scull_empty_give_n(dev, slots);
+		return -EFAULT;
+	}
+	iov_iter_advance(from, count - len);
+	hdr = scull_hdr(dev->FIFO_arr, end);
+	hdr->len = len;
+	hdr->stamp = ktime_get_ns();
+	
+	// move past the element's slots; tail wraps when taken modulo size
+	atomic64_add(slots, &dev->ctl->tail);
+	up(&dev->sem);
+	scull_full_give(dev);
+	return len;
+}
+
+/*
+ * Byte ring mode.
+ *
+ * Records are packed back to back in FIFO_arr, each a struct
+ * scull_elem_hdr and the payload padded to the header's size, so a header
+ * never straddles the end of the ring but a payload may and is then
+ * copied in two pieces. head/tail are
+ * byte positions, empty counts free bytes and full counts records.
+ * Moving head/tail happens under sem, like the locked ring.
+ */
+static inline size_t scull_record_size(size_t len)
+{
+	return ALIGN(sizeof(struct scull_elem_hdr) + len,
+			sizeof(struct scull_elem_hdr));
+}
+
+static size_t scull_bytes_out(struct scull_dev *dev, u64 pos, size_t len,
+		struct iov_iter *to)
+{
+	size_t off = pos % dev->fifo_bytes;
+	size_t first = min_t(size_t, len, dev->fifo_bytes - off);
+	size_t n = copy_to_iter(dev->FIFO_arr + off, first, to);
+
+	if (n == first && len > first)
+		n += copy_to_iter(dev->FIFO_arr, len - first, to);
+	return n;
+}
+
+static size_t scull_bytes_in(struct scull_dev *dev, u64 pos, size_t len,
+		struct iov_iter *from)
+{
+	size_t off = pos % dev->fifo_bytes;
+	size_t first = min_t(size_t, len, dev->fifo_bytes - off);
+	size_t n = copy_from_iter(dev->FIFO_arr + off, first, from);
+
+	if (n == first && len > first)
+		n += copy_from_iter(dev->FIFO_arr, len - first, from);
+	return n;
+}
+
+static ssize_t scull_get_bytes(struct scull_dev *dev, struct iov_iter *to,
+		unsigned int fmt, bool more, bool block)
+{
+	size_t room = iov_iter_count(to) - scull_out_hdr(fmt);
+	struct scull_elem_hdr *hdr;
+	__u32 len, n;
+	u64 head, now;
+	ssize_t ret;
+
+	ret = scull_full_take(dev, block);
+	if (ret)
+		return ret;
+	if (scull_lock(dev)) {
+		scull_full_give(dev);
+		return -ERESTARTSYS;
+	}
+
+	head = atomic64_read(&dev->ctl->head);
+	hdr = (struct scull_elem_hdr *)(dev->FIFO_arr + head % dev->fifo_bytes);
+	len = hdr->len;
+	if (more && room < len) {
+		up(&dev->sem);
+		scull_full_give(dev);
+		return -EMSGSIZE;
+	}
+
+	/* truncate to the room left, like the slot modes */
+	n = min_t(size_t, len, room);
+	now = ktime_get_ns();
+	if (scull_hdr_out(to, hdr, n, now, fmt) ||
+	    scull_bytes_out(dev, head + sizeof(*hdr), n, to) != n) {
+		up(&dev->sem);
+		scull_full_give(dev);
+		return -EFAULT;
+	}
+	scull_stat_residence(dev, hdr->stamp, now);
+	atomic64_add(scull_record_size(len), &dev->ctl->head);
+	up(&dev->sem);
+	scull_empty_give_n(dev, scull_record_size(len));
+	return scull_out_hdr(fmt) + n;
+}
+
+static ssize_t scull_put_bytes(struct scull_dev *dev, struct iov_iter *from,
+		size_t count, bool block)
+{
+	size_t len = min_t(size_t, count, scull_fifo_elemsz);
+	size_t rec = scull_record_size(len);
+	struct scull_elem_hdr *hdr;
+	u64 tail;
+	ssize_t ret;
+
+	ret = scull_empty_take_n(dev, rec, block);
+	if (ret)
+		return ret;
+	if (scull_lock(dev)) {
+		scull_empty_give_n(dev, rec);
+		return -ERESTARTSYS;
+	}
+
+	tail = atomic64_read(&dev->ctl->tail);
+	if (scull_bytes_in(dev, tail + sizeof(*hdr), len, from) != len) {
+		up(&dev->sem);
+		scull_empty_give_n(dev, rec);
+		return -EFAULT;
+	}
+	iov_iter_advance(from, count - len);
+	hdr = (struct scull_elem_hdr *)(dev->FIFO_arr + tail % dev->fifo_bytes);
+	hdr->len = len;
+	hdr->stamp = ktime_get_ns();
+	atomic64_add(rec, &dev->ctl->tail);
+	up(&dev->sem);
+	scull_full_give(dev);
+	return len;
+}
+
+/*
+ * Sharded mode.
+ *
+ * Every device has nr_shards small locked rings of size slots each, so
+ * writers on different CPUs don't fight over one lock and one pair of
+ * cursors. A thread always writes to the same shard, picked by its pid;
+ * picking by CPU would reorder a producer's elements whenever it migrates.
+ * Readers drain the shard of their own pid first and steal from the others
+ * in turn when it is empty.
+ *
+ * Ordering: elements written by one thread are read in the order they were
+ * written. There is no order between different writers, and a thread that
+ * writes through several devices or from several threads gets no order
+ * across them.
+ *
+ * Priority mode uses the same rings as lanes: one per priority rather
+ * than per CPU, each of its own size. A write goes to the lane its file
+ * picked, and readers always scan from lane 0, so they take from the most
+ * urgent lane that has anything. A full lane only blocks its own writers,
+ * so bulk traffic can't take the room urgent messages need.
+ *
+ * The rings' head/tail are only changed under the shard's lock, but are
+ * peeked at without it to find work and to decide whether to sleep.
+ */
+struct scull_shard {
+	struct mutex lock;
+	char *arr;		/* size slots */
+	int size;
+	u64 head, tail;		/* free-running positions */
+} ____cacheline_aligned_in_smp;
+
+/* sharded and priority mode both keep their elements in shards */
+static inline bool scull_sharded(void)
+{
+	return scull_fifo_mode == SCULL_FIFO_MODE_SHARDED ||
+	       scull_fifo_mode == SCULL_FIFO_MODE_PRIO;
+}
+
+static inline struct scull_shard *scull_home_shard(struct scull_dev *dev)
+{
+	return &dev->shards[task_pid_nr(current) % dev->nr_shards];
+}
+
+/* where a write on a file using lane goes */
+static inline struct scull_shard *scull_put_shard(struct scull_dev *dev,
+		int lane)
+{
+	if (scull_fifo_mode == SCULL_FIFO_MODE_PRIO)
+		return &dev->shards[lane];
+	return scull_home_shard(dev);
+}
+
+static inline bool scull_shard_empty(struct scull_shard *shard)
+{
+	return READ_ONCE(shard->tail) == READ_ONCE(shard->head);
+}
+
+static inline bool scull_shard_full(struct scull_shard *shard)
+{
+	return READ_ONCE(shard->tail) - READ_ONCE(shard->head) >= shard->size;
+}
+
+static bool scull_shards_ready(struct scull_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->nr_shards; i++)
+		if (!scull_shard_empty(&dev->shards[i]))
+			return true;
+	return false;
+}
+
+/* lock a shard, counting the times it had to sleep like scull_lock() */
+static int scull_shard_lock(struct scull_dev *dev, struct scull_shard *shard)
+{
+	u64 t0;
+	int ret;
+
+	if (mutex_trylock(&shard->lock))
+		return 0;
+	t0 = ktime_get_ns();
+	ret = mutex_lock_interruptible(&shard->lock);
+	scull_stat_wait(dev, sem, t0);
+	return ret;
+}
+
+/* wake a side of the device, if anyone is waiting there */
+static void scull_shard_wake(wait_queue_head_t *wq, __poll_t events)
+{
+	smp_mb(); /* pairs with set_current_state() in the waiter */
+	if (waitqueue_active(wq))
+		wake_up_interruptible_poll(wq, events);
+}
+
+/* take the oldest element of one shard, -EAGAIN if it has none */
+static ssize_t scull_shard_get(struct scull_dev *dev, struct scull_shard *shard,
+		struct iov_iter *to, unsigned int fmt, bool more)
+{
+	struct scull_elem_hdr *hdr;
+	unsigned long idx;
+	ssize_t ret;
+
+	if (scull_shard_lock(dev, shard))
+		return -ERESTARTSYS;
+	if (shard->head == shard->tail) {
+		/* someone else stole it */
+		mutex_unlock(&shard->lock);
+		return -EAGAIN;
+	}
+
+	idx = shard->head % shard->size;
+	hdr = scull_hdr(shard->arr, idx);
+	if (more && iov_iter_count(to) < scull_out_hdr(fmt) + hdr->len) {
+		mutex_unlock(&shard->lock);
+		return -EMSGSIZE;
+	}
+	/* on failure the element stays for the next reader */
+	ret = scull_copy_elem_out(dev, to, hdr, hdr->len,
+			scull_data(shard->arr, shard->size, idx), fmt);
+	if (ret >= 0)
+		WRITE_ONCE(shard->head, shard->head + 1);
+	mutex_unlock(&shard->lock);
+
+	if (ret >= 0)
+		scull_shard_wake(&dev->empty_wq, EPOLLOUT | EPOLLWRNORM);
+	return ret;
+}
+
+static ssize_t scull_get_sharded(struct scull_dev *dev, struct iov_iter *to,
+		unsigned int fmt, bool more, bool block)
+{
+	int first, i;
+	ssize_t ret;
+	u64 t0;
+
+	/* lanes from the most urgent, shards from our own */
+	if (scull_fifo_mode == SCULL_FIFO_MODE_PRIO)
+		first = 0;
+	else
+		first = scull_home_shard(dev) - dev->shards;
+
+	for (;;) {
+		for (i = 0; i < dev->nr_shards; i++) {
+			struct scull_shard *shard =
+				&dev->shards[(first + i) % dev->nr_shards];
+
+			if (scull_shard_empty(shard))
+				continue;
+			ret = scull_shard_get(dev, shard, to, fmt, more);
+			if (ret != -EAGAIN)
+				return ret;
+		}
+		if (!block)
+			return -EAGAIN;
+		/* a shard that shows up ready is claimed on the next pass */
+		if (scull_spin(dev, scull_shards_ready(dev)))
+			continue;
+		t0 = ktime_get_ns();
+		ret = wait_event_interruptible(dev->full_wq,
+				scull_shards_ready(dev));
+		scull_stat_wait(dev, full, t0);
+		if (ret)
+			return -ERESTARTSYS;
+	}
+}
+
+static ssize_t scull_put_sharded(struct scull_dev *dev, struct iov_iter *from,
+		size_t count, int lane, bool block)
+{
+	struct scull_shard *shard = scull_put_shard(dev, lane);
+	struct scull_elem_hdr *hdr;
+	unsigned long idx;
+	ssize_t ret;
+	u64 t0;
+
+	if (scull_shard_lock(dev, shard))
+		return -ERESTARTSYS;
+	while (shard->tail - shard->head >= shard->size) {
+		mutex_unlock(&shard->lock);
+		if (!block)
+			return -EAGAIN;
+		/* readers of every shard share empty_wq; recheck ours */
+		if (scull_spin(dev, !scull_shard_full(shard)))
+			goto relock;
+		t0 = ktime_get_ns();
+		ret = wait_event_interruptible(dev->empty_wq,
+				!scull_shard_full(shard));
+		scull_stat_wait(dev, empty, t0);
+		if (ret)
+			return -ERESTARTSYS;
+relock:
+		if (scull_shard_lock(dev, shard))
+			return -ERESTARTSYS;
+	}
+
+	idx = shard->tail % shard->size;
+	hdr = scull_hdr(shard->arr, idx);
+	ret = scull_copy_elem_in(hdr, scull_data(shard->arr, shard->size, idx),
+			from, count);
+	if (ret >= 0) {
+		hdr->len = ret;
+		WRITE_ONCE(shard->tail, shard->tail + 1);
+	}
+	mutex_unlock(&shard->lock);
+
+	if (ret >= 0)
+		scull_shard_wake(&dev->full_wq, EPOLLIN | EPOLLRDNORM);
+	return ret;
+}
+
+static int scull_shards_alloc(struct scull_dev *dev)
+{
+	bool prio = scull_fifo_mode == SCULL_FIFO_MODE_PRIO;
+	struct scull_shard *shard;
+	int i;
+
+	dev->nr_shards = prio ? scull_nr_lanes : num_possible_cpus();
+	dev->shards = kcalloc(dev->nr_shards, sizeof(*dev->shards), GFP_KERNEL);
+	if (!dev->shards)
+		return -ENOMEM;
+	for (i = 0; i < dev->nr_shards; i++) {
+		shard = &dev->shards[i];
+		mutex_init(&shard->lock);
+		shard->size = dev->size;
+		if (prio && scull_lane_size[i] > 0)
+			shard->size = scull_lane_size[i];
+		shard->arr = kvmalloc(scull_slots_bytes(shard->size),
+				GFP_KERNEL);
+		if (!shard->arr)
+			goto fail;
+	}
+	return 0;
+
+  fail:
+	while (i-- > 0)
+		kvfree(dev->shards[i].arr);
+	kfree(dev->shards);
+	dev->shards = NULL;
+	return -ENOMEM;
+}
+
+static void scull_shards_free(struct scull_dev *dev)
+{
+	int i;
+
+	if (!dev->shards)
+		return;
+	for (i = 0; i < dev->nr_shards; i++)
+		kvfree(dev->shards[i].arr);
+	kfree(dev->shards);
+	dev->shards = NULL;
+}
+
+/*
+ * Spill file (SPILL policy).
+ *
+ * With scull_spill_dir set, every device gets <dir>/scull<index>.spill,
+ * opened at load time. A write that finds the FIFO full under the SPILL
+ * policy appends its element there instead, as a record like the byte
+ * ring's: a struct scull_elem_hdr, then the payload, padded. Everything
+ * in the file is younger than everything in the FIFO, so once anything is
+ * spilled all writes go to the file, whatever the policy by then, and
+ * reads take from the FIFO first and from the file when it is empty,
+ * until the file drains; then its pages are given back. One mutex
+ * serialises all the file I/O, which is the slow path by definition.
+ * Mappers of the lock-free ring see none of this.
+ */
+struct scull_spill {
+	struct mutex lock;
+	struct file *file;
+	loff_t head, tail;	/* next record to read, end of the last */
+	u64 nr_in, nr_out;	/* elements ever spilled and read back */
+	char *buf;		/* one record, under lock */
+};
+
+/*
+ * Elements waiting in the spill file. Lockless, so it counts elements
+ * rather than looking at head/tail, which go back to 0 on every drain.
+ */
+u64 scull_spill_queued(struct scull_dev *dev)
+{
+	struct scull_spill *sp = dev->spill;
+	u64 out;
+
+	if (!sp)
+		return 0;
+	/* out first: in can only have moved further since */
+	out = READ_ONCE(sp->nr_out);
+	return READ_ONCE(sp->nr_in) - out;
+}
+
+/*
+ * Append one element to the spill file. behind: only to keep it behind
+ * what is already spilled, and -EAGAIN if readers have drained that in
+ * the meantime, since they may be waiting on the FIFO alone by now.
+ */
+static ssize_t scull_spill_put(struct scull_dev *dev, struct iov_iter *from,
+		size_t count, bool behind)
+{
+	struct scull_spill *sp = dev->spill;
+	struct scull_elem_hdr *hdr = (struct scull_elem_hdr *)sp->buf;
+	size_t len = min_t(size_t, count, scull_msg_max());
+	size_t rec = scull_record_size(len);
+	loff_t pos;
+	ssize_t ret;
+
+	if (mutex_lock_interruptible(&sp->lock))
+		return -ERESTARTSYS;
+	ret = -EAGAIN;
+	if (behind && sp->nr_in == sp->nr_out)
+		goto out;
+	ret = -EFAULT;
+	if (copy_from_iter(sp->buf + sizeof(*hdr), len, from) != len)
+		goto out;
+	iov_iter_advance(from, count - len);
+	hdr->len = len;
+	hdr->pad = 0;
+	hdr->stamp = ktime_get_ns();
+
+	/* a short write leaves tail alone, the next one overwrites it */
+	pos = sp->tail;
+	ret = kernel_write(sp->file, sp->buf, rec, &pos);
+	if (ret >= 0 && ret != rec)
+		ret = -EIO;
+	if (ret < 0)
+		goto out;
+	sp->tail = pos;
+	WRITE_ONCE(sp->nr_in, sp->nr_in + 1);
+	scull_stat_inc(dev, spilled);
+	scull_stat_add(dev, spill_bytes, rec);
+	ret = len;
+out:
+	mutex_unlock(&sp->lock);
+	if (ret >= 0)
+		scull_shard_wake(&dev->full_wq, EPOLLIN | EPOLLRDNORM);
+	return ret;
+}
+
+static bool scull_fifo_readable(struct scull_dev *dev);
+
+/*
+ * Take the oldest spilled element, -EAGAIN if there is none. The FIFO
+ * may have filled up again since the caller found it empty, and then its
+ * elements come first: -EBUSY.
+ */
+static ssize_t scull_spill_get(struct scull_dev *dev, struct iov_iter *to,
+		unsigned int fmt, bool more)
+{
+	struct scull_spill *sp = dev->spill;
+	struct scull_elem_hdr *hdr = (struct scull_elem_hdr *)sp->buf;
+	size_t n;
+	loff_t pos;
+	ssize_t ret;
+
+	if (mutex_lock_interruptible(&sp->lock))
+		return -ERESTARTSYS;
+	ret = -EAGAIN;
+	if (sp->head == sp->tail)
+		goto out;
+	ret = -EBUSY;
+	if (scull_fifo_readable(dev))
+		goto out;
+
+	/* the next record is never longer than the largest one */
+	n = min_t(u64, sp->tail - sp->head,
+			scull_record_size(scull_msg_max()));
+	pos = sp->head;
+	ret = kernel_read(sp->file, sp->buf, n, &pos);
+	if (ret >= 0 && (ret != n || hdr->len < 0 ||
+			 hdr->len > scull_msg_max() ||
+			 scull_record_size(hdr->len) > n))
+		ret = -EIO;
+	if (ret < 0)
+		goto out;
+	ret = -EMSGSIZE;
+	if (more && iov_iter_count(to) < scull_out_hdr(fmt) + hdr->len)
+		goto out;
+
+	/* on failure the element stays for the next reader */
+	ret = scull_copy_elem_out(dev, to, hdr, hdr->len,
+			sp->buf + sizeof(*hdr), fmt);
+	if (ret < 0)
+		goto out;
+	sp->head += scull_record_size(hdr->len);
+	WRITE_ONCE(sp->nr_out, sp->nr_out + 1);
+	if (sp->head == sp->tail) {
+		/* drained: free what tmpfs and friends hold, start over */
+		vfs_fallocate(sp->file, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+				0, sp->tail);
+		sp->head = sp->tail = 0;
+	}
+out:
+	mutex_unlock(&sp->lock);
+	return ret;
+}
+
+/* length of the oldest spilled element, 0 if there is none */
+static int scull_spill_next_len(struct scull_dev *dev)
+{
+	struct scull_spill *sp = dev->spill;
+	struct scull_elem_hdr hdr;
+	loff_t pos;
+	ssize_t ret = 0;
+
+	if (!sp)
+		return 0;
+	if (mutex_lock_interruptible(&sp->lock))
+		return -ERESTARTSYS;
+	if (sp->head != sp->tail) {
+		pos = sp->head;
+		ret = kernel_read(sp->file, &hdr, sizeof(hdr), &pos);
+		if (ret >= 0)
+			ret = ret == sizeof(hdr) ? hdr.len : -EIO;
+	}
+	mutex_unlock(&sp->lock);
+	return ret;
+}
+
+static int scull_spill_open(struct scull_dev *dev)
+{
+	struct scull_spill *sp;
+	char *path;
+	int err = -ENOMEM;
+
+	if (!scull_spill_dir || !*scull_spill_dir)
+		return 0;
+	sp = kzalloc(sizeof(*sp), GFP_KERNEL);
+	if (!sp)
+		return -ENOMEM;
+	sp->buf = kvmalloc(scull_record_size(scull_msg_max()), GFP_KERNEL);
+	path = kasprintf(GFP_KERNEL, "%s/scull%d.spill", scull_spill_dir,
+			dev->index);
+	if (!sp->buf || !path)
+		goto fail;
+
+	sp->file = filp_open(path, O_RDWR | O_CREAT | O_TRUNC | O_LARGEFILE,
+			0600);
+	if (IS_ERR(sp->file)) {
+		err = PTR_ERR(sp->file);
+		printk(KERN_WARNING "scull%d: can't open %s: %d\n",
+				dev->index, path, err);
+		goto fail;
+	}
+	kfree(path);
+	mutex_init(&sp->lock);
+	dev->spill = sp;
+	return 0;
+
+  fail:
+	kfree(path);
+	kvfree(sp->buf);
+	kfree(sp);
+	return err;
+}
+
+static void scull_spill_close(struct scull_dev *dev)
+{
+	struct scull_spill *sp = dev->spill;
+
+	if (!sp)
+		return;
+	filp_close(sp->file, NULL);
+	kvfree(sp->buf);
+	kfree(sp);
+	dev->spill = NULL;
+}
+
+static ssize_t scull_get_one(struct scull_dev *dev, struct iov_iter *to,
+		unsigned int fmt, bool more, bool block)
+{
+	switch (scull_fifo_mode) {
+	case SCULL_FIFO_MODE_LOCKFREE:
+		return scull_get_lockfree(dev, to, fmt, more, block);
+	case SCULL_FIFO_MODE_BYTES:
+		return scull_get_bytes(dev, to, fmt, more, block);
+	case SCULL_FIFO_MODE_SHARDED:
+	case SCULL_FIFO_MODE_PRIO:
+		return scull_get_sharded(dev, to, fmt, more, block);
+	default:
+		return scull_get_locked(dev, to, fmt, more, block);
+	}
+}
+
+/* the FIFO, then the spill file; sleep until either has something */
+static ssize_t scull_get_spill(struct scull_dev *dev, struct iov_iter *to,
+		unsigned int fmt, bool more, bool block)
+{
+	ssize_t ret;
+	u64 t0;
+
+	for (;;) {
+		ret = scull_get_one(dev, to, fmt, more, false);
+		if (ret != -EAGAIN)
+			return ret;
+		ret = scull_spill_get(dev, to, fmt, more);
+		if (ret == -EBUSY)
+			continue;
+		if (ret != -EAGAIN || !block)
+			return ret;
+		t0 = ktime_get_ns();
+		ret = wait_event_interruptible(dev->full_wq,
+				scull_ready(dev, 0) & EPOLLIN);
+		scull_stat_wait(dev, full, t0);
+		if (ret)
+			return -ERESTARTSYS;
+	}
+}
+
+ssize_t scull_get(struct scull_dev *dev, struct iov_iter *to,
+		unsigned int fmt, bool more, bool block)
+{
+	ssize_t ret;
+
+	if (dev->spill && (READ_ONCE(dev->policy) == SCULL_POLICY_SPILL ||
+			   scull_spill_queued(dev)))
+		ret = scull_get_spill(dev, to, fmt, more, block);
+	else
+		ret = scull_get_one(dev, to, fmt, more, block);
+
+	if (ret >= 0) {
+		scull_stat_inc(dev, dequeued);
+		scull_stat_add(dev, bytes_out, ret);
+	}
+	return ret;
+}
+
+/*
+ * SCULL_IOCGNEXTLEN: how long the element the next read takes is, so
+ * that the reader can size its buffer. Only the locked and the byte ring
+ * keep it in one known place, at head; when they are empty, it is the
+ * oldest spilled one. Another reader may of course take it first.
+ */
+int scull_next_len(struct scull_dev *dev)
+{
+	struct scull_elem_hdr *hdr;
+	bool found = false;
+	int len = 0;
+	u64 head;
+
+	if (scull_fifo_mode != SCULL_FIFO_MODE_LOCKED &&
+	    scull_fifo_mode != SCULL_FIFO_MODE_BYTES)
+		return -ENODEV;
+	if (scull_lock(dev))
+		return -ERESTARTSYS;
+	head = atomic64_read(&dev->ctl->head);
+	if (head != atomic64_read(&dev->ctl->tail)) {
+		if (scull_fifo_mode == SCULL_FIFO_MODE_BYTES)
+			hdr = (struct scull_elem_hdr *)(dev->FIFO_arr +
+					head % dev->fifo_bytes);
+		else
+			hdr = scull_hdr(dev->FIFO_arr, head % dev->size);
+		len = hdr->len;
+		found = true;
+	}
+	up(&dev->sem);
+	return found ? len : scull_spill_next_len(dev);
+}
+
+/* what is queued right now, as far as the stats are concerned */
+static u64 scull_occupancy(struct scull_dev *dev, int lane)
+{
+	struct scull_shard *shard;
+	u64 head;
+
+	if (scull_sharded()) {
+		shard = scull_put_shard(dev, lane);
+		head = READ_ONCE(shard->head);
+		return READ_ONCE(shard->tail) - head;
+	}
+	/* head first: tail can only have moved further since */
+	head = atomic64_read(&dev->ctl->head);
+	return atomic64_read(&dev->ctl->tail) - head;
+}
+
+static ssize_t scull_put_one(struct scull_dev *dev, struct iov_iter *from,
+		size_t count, int lane, bool block)
+{
+	switch (scull_fifo_mode) {
+	case SCULL_FIFO_MODE_LOCKFREE:
+		return scull_put_lockfree(dev, from, count, block);
+	case SCULL_FIFO_MODE_BYTES:
+		return scull_put_bytes(dev, from, count, block);
+	case SCULL_FIFO_MODE_SHARDED:
+	case SCULL_FIFO_MODE_PRIO:
+		return scull_put_sharded(dev, from, count, lane, block);
+	default:
+		return scull_put_locked(dev, from, count, block);
+	}
+}
+
+/*
+ * OVERWRITE policy: consume the oldest element where a write to lane
+ * would go, like a reader with no room would, to make space.
+ */
+static ssize_t scull_drop_oldest(struct scull_dev *dev, int lane)
+{
+	struct iov_iter discard;
+
+	iov_iter_kvec(&discard, READ, NULL, 0, 0);
+	switch (scull_fifo_mode) {
+	case SCULL_FIFO_MODE_LOCKFREE:
+		return scull_get_lockfree(dev, &discard, 0, false, false);
+	case SCULL_FIFO_MODE_BYTES:
+		return scull_get_bytes(dev, &discard, 0, false, false);
+	case SCULL_FIFO_MODE_SHARDED:
+	case SCULL_FIFO_MODE_PRIO:
+		return scull_shard_get(dev, scull_put_shard(dev, lane),
+				&discard, 0, false);
+	default:
+		return scull_get_locked(dev, &discard, 0, false, false);
+	}
+}
+
+/*
+ * Enqueue one element as the device's policy says. Only BLOCK ever
+ * waits for room; the others never get -EAGAIN from a full FIFO, which
+ * is what they act on. Making room for an overwrite can race with other
+ * writers taking it first, so that just goes round again. While anything
+ * is spilled, new elements queue up behind it in the file.
+ */
+ssize_t scull_put(struct scull_dev *dev, struct iov_iter *from,
+		size_t count, int lane, bool block)
+{
+	int policy = READ_ONCE(dev->policy);
+	ssize_t ret;
+
+	if (scull_spill_queued(dev)) {
+		ret = scull_spill_put(dev, from, count, true);
+		if (ret != -EAGAIN)
+			goto done;
+	}
+	for (;;) {
+		ret = scull_put_one(dev, from, count, lane,
+				block && policy == SCULL_POLICY_BLOCK);
+		if (ret != -EAGAIN || policy == SCULL_POLICY_BLOCK)
+			break;
+		if (policy == SCULL_POLICY_DROP) {
+			scull_stat_inc(dev, dropped);
+			atomic64_inc(&dev->lost);
+			return -ENOSPC;
+		}
+		if (policy == SCULL_POLICY_SPILL) {
+			ret = scull_spill_put(dev, from, count, false);
+			break;
+		}
+		ret = scull_drop_oldest(dev, lane);
+		if (ret >= 0) {
+			scull_stat_inc(dev, overruns);
+			atomic64_inc(&dev->lost);
+		} else if (ret != -EAGAIN) {
+			return ret;	/* interrupted */
+		}
+	}
+
+done:
+	if (ret >= 0) {
+		scull_stat_inc(dev, enqueued);
+		scull_stat_add(dev, bytes_in, ret);
+		if (ret < count)
+			scull_stat_inc(dev, truncated);
+		scull_stat_occupancy(dev, scull_occupancy(dev, lane));
+	}
+	return ret;
+}
+
+/* anything in the FIFO proper that no reader has claimed yet */
+static bool scull_fifo_readable(struct scull_dev *dev)
+{
+	if (scull_sharded())
+		return scull_shards_ready(dev);
+	return atomic_read(&dev->ctl->full) > 0;
+}
+
+/* empty credits that guarantee any write can go ahead */
+static int scull_write_credits(void)
+{
+	if (scull_fifo_mode == SCULL_FIFO_MODE_BYTES)
+		return scull_record_size(scull_fifo_elemsz);
+	return scull_msg_slots(scull_msg_max());
+}
+
+/*
+ * Readable while there are full credits, writable while there are empty
+ * ones (enough for the largest record, or fragmented element) for a file
+ * writing to lane. Under the other policies a write never waits, so it is
+ * always writable, and so it is while there is a spill file to append to,
+ * which is also readable.
+ */
+__poll_t scull_ready(struct scull_dev *dev, int lane)
+{
+	__poll_t mask = 0;
+
+	if (READ_ONCE(dev->policy) != SCULL_POLICY_BLOCK)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	if (scull_spill_queued(dev))
+		mask |= EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+	if (scull_fifo_readable(dev))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (scull_sharded()) {
+		/* writable means the shard this caller writes to has room */
+		if (!scull_shard_full(scull_put_shard(dev, lane)))
+			mask |= EPOLLOUT | EPOLLWRNORM;
+		return mask;
+	}
+	if (atomic_read(&dev->ctl->empty) >= scull_write_credits())
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	return mask;
+}
+
+/*
+ * Ring memory
+ *
+ * The ring proper is FIFO_arr, plus seq in lock-free mode, and is
+ * what SCULL_IOCSETSIZE reallocates; ctl is allocated once.
+ * Lock-free rings are vmalloc_user() so they can be mapped, the others
+ * use kvmalloc() so big sizes aren't limited to what kmalloc can find.
+ * A size is always in elements; a byte ring gets the bytes that many
+ * elements of elemsz would take.
+ */
+
+/* what a ring of size elements holds, in empty credits */
+static size_t scull_capacity(int size)
+{
+	if (scull_fifo_mode == SCULL_FIFO_MODE_BYTES)
+		return (size_t)size * scull_record_size(scull_fifo_elemsz);
+	return size;
+}
+
+static size_t scull_seq_bytes(int size)
+{
+	return PAGE_ALIGN((size_t)size * sizeof(u64));
+}
+
+static size_t scull_ring_bytes(int size)
+{
+	return scull_seq_bytes(size) + PAGE_ALIGN(scull_slots_bytes(size));
+}
+
+static int scull_ring_alloc(int size, char **arr, u64 **seq)
+{
+	/* credits are an atomic_t */
+	if (scull_capacity(size) > INT_MAX)
+		return -EINVAL;
+
+	if (scull_fifo_mode == SCULL_FIFO_MODE_LOCKFREE) {
+		/* the mapping is control page + ring, sized by a __u32 */
+		if (PAGE_SIZE + scull_ring_bytes(size) > U32_MAX)
+			return -EINVAL;
+		*seq = vmalloc_user(scull_ring_bytes(size));
+		if (!*seq)
+			return -ENOMEM;
+		*arr = (char *)*seq + scull_seq_bytes(size);
+		return 0;
+	}
+
+	*seq = NULL;
+	if (scull_fifo_mode == SCULL_FIFO_MODE_BYTES)
+		*arr = kvmalloc(scull_capacity(size), GFP_KERNEL);
+	else
+		*arr = kvmalloc(scull_slots_bytes(size), GFP_KERNEL);
+	return *arr ? 0 : -ENOMEM;
+}
+
+static void scull_ring_free(char *arr, u64 *seq)
+{
+	if (scull_fifo_mode == SCULL_FIFO_MODE_LOCKFREE)
+		vfree(seq); /* arr points into it */
+	else
+		kvfree(arr);
+}
+
+/* point the device's FIFO_arr/seq and ctl at a ring of size slots */
+static void scull_ring_install(struct scull_dev *dev, int size, char *arr,
+		u64 *seq)
+{
+	dev->FIFO_arr = arr;
+	dev->seq = seq;
+	dev->size = size;
+	if (scull_fifo_mode == SCULL_FIFO_MODE_BYTES)
+		dev->fifo_bytes = scull_capacity(size);
+
+	dev->ctl->size = size;
+	dev->ctl->elemsz = scull_fifo_elemsz;
+	dev->ctl->layout = scull_fifo_layout;
+	dev->ctl->hdrsz = scull_hdr_size();
+	dev->ctl->slotsz = scull_slot_size();
+	if (seq) {
+		dev->ctl->seq_off = PAGE_SIZE;
+		dev->ctl->hdr_off = PAGE_SIZE + scull_seq_bytes(size);
+		dev->ctl->data_off = dev->ctl->hdr_off + scull_data_off(size);
+		dev->map_size = PAGE_SIZE + scull_ring_bytes(size);
+		dev->ctl->map_size = dev->map_size;
+	}
+}
+
+/*
+ * SCULL_IOCSETSIZE: move everything queued into a ring of new_size slots.
+ *
+ * Nobody is between claiming a position and publishing it while we hold
+ * sem (locked, byte) or resize_rwsem for write (lock-free), so
+ * [head, tail) is exactly what is queued and can be copied over slot by
+ * slot, or byte range by byte range. Readers and writers that hold a
+ * credit but have no position yet just carry on in the new ring.
+ * Shrinking has to take the lost capacity out of the empty credits first,
+ * so it fails with -EBUSY unless the new ring holds what is queued plus
+ * what writers already hold credits for. Mapped rings can't move.
+ */
+
+/* copy the byte ring's [head, tail) to a new buffer of new_bytes */
+static void scull_bytes_move(struct scull_dev *dev, char *arr,
+		size_t new_bytes, u64 head, u64 tail)
+{
+	size_t n, from, to;
+	u64 pos;
+
+	for (pos = head; pos != tail; pos += n) {
+		from = pos % dev->fifo_bytes;
+		to = pos % new_bytes;
+		n = min3((size_t)(tail - pos), dev->fifo_bytes - from,
+				new_bytes - to);
+		memcpy(arr + to, dev->FIFO_arr + from, n);
+	}
+}
+
+int scull_resize(struct scull_dev *dev, int new_size)
+{
+	int old_size = dev->size;
+	int old_cap = scull_capacity(old_size), new_cap;
+	bool lockfree = scull_fifo_mode == SCULL_FIFO_MODE_LOCKFREE;
+	char *arr;
+	u64 *seq, head, tail, pos;
+	int err;
+
+	if (scull_sharded())
+		return -ENODEV;
+	/* a fragmented writer may be waiting for that many slots */
+	if (new_size <= 0 || new_size < scull_msg_slots(scull_msg_max()))
+		return -EINVAL;
+	/* allocate outside the locks, the ring is unusable meanwhile */
+	err = scull_ring_alloc(new_size, &arr, &seq);
+	if (err)
+		return err;
+	new_cap = scull_capacity(new_size);
+
+	if (lockfree) {
+		percpu_down_write(&dev->resize_rwsem);
+	} else if (down_interruptible(&dev->sem)) {
+		scull_ring_free(arr, seq);
+		return -ERESTARTSYS;
+	}
+
+	err = -EBUSY;
+	if (lockfree && atomic_read(&dev->maps))
+		goto out;
+	if (new_cap < old_cap &&
+	    !scull_credits_sub(&dev->ctl->empty, old_cap - new_cap))
+		goto out;
+
+	head = atomic64_read(&dev->ctl->head);
+	tail = atomic64_read(&dev->ctl->tail);
+	if (scull_fifo_mode == SCULL_FIFO_MODE_BYTES)
+		scull_bytes_move(dev, arr, new_cap, head, tail);
+	else for (pos = head; pos != tail; pos++) {
+		*scull_hdr(arr, pos % new_size) =
+			*scull_hdr(dev->FIFO_arr, pos % old_size);
+		memcpy(scull_data(arr, new_size, pos % new_size),
+		       scull_data(dev->FIFO_arr, old_size, pos % old_size),
+		       scull_fifo_elemsz);
+	}
+	if (lockfree)
+		for (pos = head; pos != head + new_size; pos++)
+			seq[pos % new_size] = pos < tail ? pos + 1 : pos;
+
+	/* swap, so that the old ring is what gets freed below */
+	swap(arr, dev->FIFO_arr);
+	swap(seq, dev->seq);
+	scull_ring_install(dev, new_size, dev->FIFO_arr, dev->seq);
+	if (new_cap > old_cap)
+		atomic_add(new_cap - old_cap, &dev->ctl->empty);
+	err = 0;
+out:
+	if (lockfree)
+		percpu_up_write(&dev->resize_rwsem);
+	else
+		up(&dev->sem);
+	scull_ring_free(arr, seq);
+
+	/* more room: every blocked writer gets a go, and pollers a look */
+	if (!err && new_cap > old_cap)
+		wake_up_interruptible_all(&dev->empty_wq);
+	if (!err)
+		printk(KERN_INFO "scull%d: FIFO SIZE=%d -> %d\n",
+				dev->index, old_size, new_size);
+	return err;
+}
+
+/*
+ * Setup and teardown
+ */
+
+int scull_fifo_alloc(struct scull_dev *dev)
+{
+	int err;
+
+	sema_init(&dev->sem, 1);
+	dev->policy = scull_fifo_policy;
+	dev->spin_ns = (u64)scull_spin_us * NSEC_PER_USEC;
+	init_waitqueue_head(&dev->full_wq);
+	init_waitqueue_head(&dev->empty_wq);
+
+	/* the locked ring only uses the counters out of the control block */
+	if (scull_fifo_mode == SCULL_FIFO_MODE_LOCKFREE) {
+		BUILD_BUG_ON(sizeof(*dev->ctl) > PAGE_SIZE);
+		dev->ctl = vmalloc_user(PAGE_SIZE); /* zeroed, and safe to map */
+	} else {
+		dev->ctl = kzalloc(sizeof(*dev->ctl), GFP_KERNEL);
+	}
+	if (!dev->ctl)
+		return -ENOMEM;
+
+	err = -ENOMEM;
+	dev->stats = alloc_percpu(struct scull_stats);
+	if (!dev->stats)
+		goto fail_ctl;
+	err = percpu_init_rwsem(&dev->resize_rwsem);
+	if (err)
+		goto fail_stats;
+	err = scull_spill_open(dev);
+	if (err)
+		goto fail_rwsem;
+	if (scull_sharded()) {
+		/* no single ring: head/tail and the credits stay unused */
+		dev->size = scull_fifo_size;
+		err = scull_shards_alloc(dev);
+		if (err)
+			goto fail_spill;
+		return 0;
+	}
+	err = scull_ring_alloc(scull_fifo_size, &dev->FIFO_arr, &dev->seq);
+	if (err)
+		goto fail_spill;
+	scull_ring_install(dev, scull_fifo_size, dev->FIFO_arr, dev->seq);
+	atomic_set(&dev->ctl->empty, scull_capacity(scull_fifo_size));
+	if (dev->seq) {
+		int i;
+
+		for (i = 0; i < scull_fifo_size; i++)
+			dev->seq[i] = i;
+	}
+	return 0;
+
+  fail_spill:
+	scull_spill_close(dev);
+  fail_rwsem:
+	percpu_free_rwsem(&dev->resize_rwsem);
+  fail_stats:
+	free_percpu(dev->stats);
+	dev->stats = NULL;
+  fail_ctl:
+	if (scull_fifo_mode == SCULL_FIFO_MODE_LOCKFREE)
+		vfree(dev->ctl);
+	else
+		kfree(dev->ctl);
+	dev->ctl = NULL;
+	return err;
+}
+
+void scull_fifo_free(struct scull_dev *dev)
+{
+	if (!dev->ctl)
+		return;
+	if (scull_sharded())
+		scull_shards_free(dev);
+	else
+		scull_ring_free(dev->FIFO_arr, dev->seq); /* free memory for kernel */
+	scull_spill_close(dev);
+	percpu_free_rwsem(&dev->resize_rwsem);
+	free_percpu(dev->stats);
+	if (scull_fifo_mode == SCULL_FIFO_MODE_LOCKFREE)
+		vfree(dev->ctl);
+	else
+		kfree(dev->ctl);
+	dev->ctl = NULL;
+	dev->stats = NULL;
+	dev->seq = NULL;
+	dev->FIFO_arr = NULL;
+}
@@ -0,0 +1,692 @@
+/*
+ * main.c -- the bare scull char module
+ *
+ * Copyright (C) 2001 Alessandro Rubini and Jonathan Corbet
+ * Copyright (C) 2001 O'Reilly & Associates
+ *
+ * The source code in this file can be freely used, adapted,
+ * and redistributed in source or binary form, so long as an
+ * acknowledgment appears in derived source files.  The citation
+ * should list that the code comes from the book "Linux Device
+ * Drivers" by Alessandro Rubini and Jonathan Corbet, published
+ * by O'Reilly & Associates.   No warranty is attached;
+ * we cannot take responsibility for errors or fitness for use.
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/semaphore.h> 	/* semaphores */
+#include <linux/mutex.h> 	/* mutex */
+#include <linux/kernel.h>	/* printk() */
+#include <linux/slab.h>		/* kmalloc() */
+#include <linux/fs.h>		/* everything... */
+#include <linux/errno.h>	/* error codes */
+#include <linux/types.h>	/* size_t */
+#include <linux/cdev.h>
+#include <linux/atomic.h>	/* atomic_long_t */
+#include <linux/sched.h>	/* cond_resched() */
+#include <linux/wait.h>		/* wait queues */
+#include <linux/vmalloc.h>	/* vmalloc_user() */
+#include <linux/mm.h>		/* vm_insert_page() */
+#include <linux/uio.h>		/* iov_iter */
+#include <linux/poll.h>		/* poll_wait() */
+#include <linux/bitops.h>	/* set_bit() */
+#include <linux/percpu-rwsem.h>	/* resize vs lock-free ops */
+#include <linux/percpu.h>	/* alloc_percpu() */
+#include <linux/ktime.h>	/* ktime_get_ns() */
+#include <linux/log2.h>		/* ilog2() */
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include <linux/uaccess.h>	/* copy_*_user */
+
+#include "scull.h"		/* local definitions */
+#include "scull_fifo.h"
+#include "access_ok_version.h"
+#include "splice_version.h"
+#include "vm_flags_version.h"
+
+/*
+ * Our parameters which can be set at load time.
+ */
+
+static int scull_major =   SCULL_MAJOR;
+static int scull_minor =   0;
+int scull_fifo_elemsz = SCULL_FIFO_ELEMSZ_DEFAULT; /* SIZE */
+int scull_fifo_size   = SCULL_FIFO_SIZE_DEFAULT; /* N */
+int scull_fifo_msgsz  = 0;		/* 0: SIZE, more fragments */
+int scull_fifo_mode   = SCULL_FIFO_MODE_LOCKED;
+int scull_fifo_policy = SCULL_POLICY_BLOCK;
+int scull_fifo_layout = SCULL_LAYOUT_PACKED;
+static int scull_nr_devs     = SCULL_NR_DEVS;	/* number of FIFOs */
+int scull_nr_lanes    = SCULL_NR_LANES;	/* PRIO mode */
+int scull_lane_size[SCULL_LANES_MAX];	/* 0: scull_fifo_size */
+int scull_spin_us     = 0;		/* busy-poll before sleeping */
+char *scull_spill_dir;			/* SPILL policy files go here */
+
+module_param(scull_major, int, S_IRUGO);
+module_param(scull_minor, int, S_IRUGO);
+module_param(scull_nr_devs, int, S_IRUGO);
+module_param(scull_fifo_size, int, S_IRUGO);
+module_param(scull_fifo_elemsz, int, S_IRUGO);
+module_param(scull_fifo_msgsz, int, S_IRUGO);
+module_param(scull_fifo_mode, int, S_IRUGO);
+module_param(scull_fifo_policy, int, S_IRUGO);
+module_param(scull_fifo_layout, int, S_IRUGO);
+module_param(scull_nr_lanes, int, S_IRUGO);
+module_param_array(scull_lane_size, int, NULL, S_IRUGO);
+module_param(scull_spin_us, int, S_IRUGO);
+module_param(scull_spill_dir, charp, S_IRUGO);
+
+MODULE_AUTHOR("Wonderful student of CS-492");
+MODULE_LICENSE("Dual BSD/GPL");
+
+static struct scull_dev *scull_devices;	/* allocated in scull_init_module */
+
+/* per-open state, in filp->private_data */
+struct scull_file {
+	struct scull_dev *dev;
+	unsigned long flags;
+	int lane;		/* SCULL_IOCSPRIO */
+	u64 lost_mark;		/* dev->lost at the last read */
+};
+/* bits in scull_file.flags */
+#define SCULL_FILE_FRAMED	0	/* SCULL_IOCSFRAMED */
+#define SCULL_FILE_POLLED	1	/* counted in ctl->pollers */
+#define SCULL_FILE_STAMPED	2	/* SCULL_IOCSSTAMPED */
+
+/*
+ * Open and close
+ */
+
+static int scull_open(struct inode *inode, struct file *filp)
+{
+	struct scull_file *sf;
+
+	sf = kzalloc(sizeof(*sf), GFP_KERNEL);
+	if (!sf)
+		return -ENOMEM;
+	sf->dev = container_of(inode->i_cdev, struct scull_dev, cdev);
+	sf->lane = scull_nr_lanes - 1;
+	sf->lost_mark = atomic64_read(&sf->dev->lost);
+	filp->private_data = sf;
+	/* IOCB_NOWAIT is honoured, so io_uring may try us inline first */
+	filp->f_mode |= FMODE_NOWAIT;
+	printk(KERN_INFO "scull open\n");
+	return 0;          /* success */
+}
+
+static int scull_release(struct inode *inode, struct file *filp)
+{
+	struct scull_file *sf = filp->private_data;
+
+	if (test_bit(SCULL_FILE_POLLED, &sf->flags))
+		atomic_dec(&sf->dev->ctl->pollers);
+	kfree(sf);
+	printk(KERN_INFO "scull close\n");
+	return 0;          /* success */
+}
+
+/*
+ * Read and Write
+ *
+ * Both go through read_iter/write_iter, so readv()/writev() behave like
+ * read()/write() on the gathered buffer:
+ *   plain  - a read returns (the head of) one element and a write makes
+ *            one element
+ *   framed - after SCULL_IOCSFRAMED the buffer is a run of records, each a
+ *            __u32 length followed by that many bytes; a read returns as
+ *            many whole elements as fit, a write enqueues every record
+ * After SCULL_IOCSSTAMPED each element read also comes with a struct
+ * scull_stamp in front, whether plain or framed; writes don't change.
+ * With scull_fifo_msgsz above SIZE, elements are never cut short on the
+ * way out: a read without room for the next one whole fails with
+ * -EMSGSIZE and leaves it queued.
+ *
+ * splice() and sendfile() come through the same two paths, with an
+ * iov_iter over the pipe's pages instead of a user buffer, so forwarding
+ * data costs one copy instead of two. Splicing in, each write_iter makes
+ * one element and whatever didn't fit stays in the pipe for the next, so
+ * a stream is cut into pieces of the largest element; splicing out moves
+ * one element, or in framed mode as many records as fit in the pipe.
+ *
+ * io_uring first issues a read or write with IOCB_NOWAIT and only hands
+ * it to a worker thread if that returns -EAGAIN and the file can't be
+ * polled. Both are covered: IOCB_NOWAIT is treated like O_NONBLOCK, and
+ * scull_poll() wakes with the EPOLLIN/EPOLLOUT key the retry waits for.
+ * Like pipes, the short hold of sem or a shard's lock is still waited out.
+ */
+
+/* O_NONBLOCK or IOCB_NOWAIT: -EAGAIN rather than sleeping on full/empty */
+static inline bool scull_may_block(struct kiocb *iocb)
+{
+	return !(iocb->ki_filp->f_flags & O_NONBLOCK) &&
+	       !(iocb->ki_flags & IOCB_NOWAIT);
+}
+
+static ssize_t scull_read_elems(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct scull_file *sf = iocb->ki_filp->private_data;
+	struct scull_dev *dev = sf->dev;
+	bool block = scull_may_block(iocb);
+	bool whole = scull_fifo_msgsz > scull_fifo_elemsz;
+	unsigned int fmt = 0;
+	ssize_t ret, done;
+
+	if (test_bit(SCULL_FILE_STAMPED, &sf->flags))
+		fmt |= SCULL_GET_STAMPED;
+	if (!test_bit(SCULL_FILE_FRAMED, &sf->flags)) {
+		if (iov_iter_count(to) < scull_out_hdr(fmt))
+			return -EINVAL;
+		return scull_get(dev, to, fmt, whole, block);
+	}
+
+	fmt |= SCULL_GET_FRAMED;
+	if (iov_iter_count(to) < scull_out_hdr(fmt))
+		return -EINVAL;
+	/* wait for the first element only, then take what is there */
+	done = scull_get(dev, to, fmt, whole, block);
+	while (done > 0 && iov_iter_count(to) >= scull_out_hdr(fmt)) {
+		ret = scull_get(dev, to, fmt, true, false);
+		if (ret < 0)
+			break;
+		done += ret;
+	}
+	return done;
+}
+
+static ssize_t scull_write_elems(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct scull_file *sf = iocb->ki_filp->private_data;
+	struct scull_dev *dev = sf->dev;
+	bool block = scull_may_block(iocb);
+	ssize_t ret = 0, done = 0;
+	__u32 len;
+
+	if (!test_bit(SCULL_FILE_FRAMED, &sf->flags))
+		return scull_put(dev, from, iov_iter_count(from), sf->lane,
+				block);
+
+	while (iov_iter_count(from)) {
+		ret = -EINVAL; /* a partial record */
+		if (iov_iter_count(from) < SCULL_FRAME_HDR)
+			break;
+		if (copy_from_iter(&len, SCULL_FRAME_HDR, from) != SCULL_FRAME_HDR) {
+			ret = -EFAULT;
+			break;
+		}
+		if (len > iov_iter_count(from))
+			break;
+		ret = scull_put(dev, from, len, sf->lane, block);
+		if (ret < 0)
+			break;
+		done += SCULL_FRAME_HDR + len;
+	}
+	/* report what got queued; only fail if nothing did */
+	return done ? done : ret;
+}
+
+/* the entry points only add the latency histograms */
+static ssize_t scull_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct scull_file *sf = iocb->ki_filp->private_data;
+	u64 lost = atomic64_read(&sf->dev->lost);
+	u64 t0 = ktime_get_ns();
+	ssize_t ret = scull_read_elems(iocb, to);
+
+	if (ret >= 0) {
+		scull_stat_inc(sf->dev,
+			read_ns[scull_hist_bucket(ktime_get_ns() - t0)]);
+		WRITE_ONCE(sf->lost_mark, lost);
+	}
+	return ret;
+}
+
+static ssize_t scull_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct scull_file *sf = iocb->ki_filp->private_data;
+	u64 t0 = ktime_get_ns();
+	ssize_t ret = scull_write_elems(iocb, from);
+
+	if (ret >= 0)
+		scull_stat_inc(sf->dev,
+			write_ns[scull_hist_bucket(ktime_get_ns() - t0)]);
+	return ret;
+}
+
+/*
+ * poll: see scull_ready() for what readable and writable mean. The
+ * driver's givers wake both wait queues' pollers; a file that has polled
+ * is also counted in ctl->pollers, which tells mappers to use
+ * SCULL_IOCWAKE on every give.
+ */
+static __poll_t scull_poll(struct file *filp, poll_table *wait)
+{
+	struct scull_file *sf = filp->private_data;
+	struct scull_dev *dev = sf->dev;
+
+	if (!poll_does_not_wait(wait) &&
+	    !test_and_set_bit(SCULL_FILE_POLLED, &sf->flags)) {
+		atomic_inc(&dev->ctl->pollers);
+		smp_mb__after_atomic();
+	}
+	poll_wait(filp, &dev->full_wq, wait);
+	poll_wait(filp, &dev->empty_wq, wait);
+	return scull_ready(dev, sf->lane);
+}
+
+/*
+ * mmap: the control page followed by the lock-free ring, as one mapping
+ * of up to dev->map_size bytes from offset 0. The two are separate
+ * vmalloc_user() areas, so the pages go in one at a time. ctl->map_size
+ * is only a copy for mappers: they can write it, so it is never trusted
+ * here. Shared mappings only, and VM_DONTEXPAND keeps the vma from
+ * growing later.
+ */
+static void scull_vma_open(struct vm_area_struct *vma)
+{
+	struct scull_dev *dev = vma->vm_private_data;
+
+	atomic_inc(&dev->maps);
+}
+
+static void scull_vma_close(struct vm_area_struct *vma)
+{
+	struct scull_dev *dev = vma->vm_private_data;
+
+	atomic_dec(&dev->maps);
+}
+
+static const struct vm_operations_struct scull_vm_ops = {
+	.open	= scull_vma_open,
+	.close	= scull_vma_close,
+};
+
+static int scull_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct scull_file *sf = filp->private_data;
+	struct scull_dev *dev = sf->dev;
+	unsigned long uaddr = vma->vm_start;
+	unsigned long off;
+	void *kaddr;
+	int err = 0;
+
+	if (scull_fifo_mode != SCULL_FIFO_MODE_LOCKFREE)
+		return -ENODEV;
+	if (!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	percpu_down_read(&dev->resize_rwsem); /* keep the ring where it is */
+	if (vma->vm_pgoff != 0 ||
+	    vma->vm_end - vma->vm_start > dev->map_size) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	vm_flags_set_wrapper(vma, VM_DONTEXPAND | VM_DONTDUMP);
+	for (off = 0; uaddr < vma->vm_end; off += PAGE_SIZE, uaddr += PAGE_SIZE) {
+		if (off == 0)
+			kaddr = dev->ctl;
+		else
+			kaddr = (char *)dev->seq + off - PAGE_SIZE;
+		err = vm_insert_page(vma, uaddr, vmalloc_to_page(kaddr));
+		if (err)
+			goto out;
+	}
+	vma->vm_ops = &scull_vm_ops;
+	vma->vm_private_data = dev;
+	scull_vma_open(vma);
+out:
+	percpu_up_read(&dev->resize_rwsem);
+	return err;
+}
+
+/*
+ * The ioctl() implementation
+ */
+
+static long scull_ioctl(struct file *filp, unsigned int cmd,
+		unsigned long arg)
+{
+
+	int err = 0;
+	int retval = 0;
+	struct scull_file *sf = filp->private_data;
+	struct scull_dev *dev = sf->dev;
+	struct scull_stats *stats;
+    
+	/*
+	 * extract the type and number bitfields, and don't decode
+	 * wrong cmds: return ENOTTY (inappropriate ioctl) before access_ok()
+	 */
+	if (_IOC_TYPE(cmd) != SCULL_IOC_MAGIC) return -ENOTTY;
+	if (_IOC_NR(cmd) > SCULL_IOC_MAXNR) return -ENOTTY;
+
+	/*
+	 * the direction is a bitmask, and VERIFY_WRITE catches R/W
+	 * transfers. `Type' is user-oriented, while
+	 * access_ok is kernel-oriented, so the concept of "read" and
+	 * "write" is reversed
+	 */
+	if (_IOC_DIR(cmd) & _IOC_READ)
+		err = !access_ok_wrapper(VERIFY_WRITE, (void __user *)arg,
+				_IOC_SIZE(cmd));
+	else if (_IOC_DIR(cmd) & _IOC_WRITE)
+		err =  !access_ok_wrapper(VERIFY_READ, (void __user *)arg,
+				_IOC_SIZE(cmd));
+	if (err) return -EFAULT;
+
+	switch(cmd) {
+	case SCULL_IOCGETELEMSZ:
+		return scull_fifo_elemsz;
+
+	case SCULL_IOCSETSIZE: /* Tell: arg is the new number of slots */
+		if (arg > INT_MAX)
+			return -EINVAL;
+		return scull_resize(dev, arg);
+
+	case SCULL_IOCGETMAPSZ:
+		if (scull_fifo_mode != SCULL_FIFO_MODE_LOCKFREE)
+			return -ENODEV;
+		return READ_ONCE(dev->map_size);
+
+	case SCULL_IOCWAIT: /* arg says which counter to take a credit from */
+		if (scull_fifo_mode != SCULL_FIFO_MODE_LOCKFREE)
+			return -ENODEV;
+		if (arg == SCULL_WAIT_FULL)
+			retval = scull_full_take(dev, true);
+		else if (arg == SCULL_WAIT_EMPTY)
+			retval = scull_empty_take(dev, true);
+		else
+			return -EINVAL;
+		if (retval)
+			return -ERESTARTSYS;
+		break;
+
+	case SCULL_IOCSFRAMED: /* Tell: arg turns framing on or off */
+		if (arg)
+			set_bit(SCULL_FILE_FRAMED, &sf->flags);
+		else
+			clear_bit(SCULL_FILE_FRAMED, &sf->flags);
+		break;
+
+	case SCULL_IOCSSTAMPED: /* Tell: arg turns stamps on or off */
+		if (arg)
+			set_bit(SCULL_FILE_STAMPED, &sf->flags);
+		else
+			clear_bit(SCULL_FILE_STAMPED, &sf->flags);
+		break;
+
+	case SCULL_IOCSPRIO: /* Tell: arg is the lane, 0 the most urgent */
+		if (scull_fifo_mode != SCULL_FIFO_MODE_PRIO)
+			return -ENODEV;
+		if (arg >= scull_nr_lanes)
+			return -EINVAL;
+		sf->lane = arg;
+		break;
+
+	case SCULL_IOCSPOLICY: /* Tell: arg is a SCULL_POLICY_* */
+		if (arg > SCULL_POLICY_SPILL)
+			return -EINVAL;
+		if (arg == SCULL_POLICY_SPILL && !dev->spill)
+			return -ENODEV;
+		WRITE_ONCE(dev->policy, arg);
+		/* never full any more: pollers waiting for room can go */
+		if (arg != SCULL_POLICY_BLOCK)
+			wake_up_interruptible_all(&dev->empty_wq);
+		break;
+
+	case SCULL_IOCGLOST: /* Query: lost since this fd's last read */
+		return min_t(u64, atomic64_read(&dev->lost) -
+				READ_ONCE(sf->lost_mark), LONG_MAX);
+
+	case SCULL_IOCSSPIN: /* Tell: arg is the busy-poll window in µs */
+		if (arg > SCULL_SPIN_MAX_US)
+			return -EINVAL;
+		WRITE_ONCE(dev->spin_ns, (u64)arg * NSEC_PER_USEC);
+		break;
+
+	case SCULL_IOCGMSGSZ:
+		return scull_msg_max();
+
+	case SCULL_IOCGNEXTLEN: /* Query: length of the oldest element */
+		return scull_next_len(dev);
+
+	case SCULL_IOCWAKE: /* the caller already gave the credit back */
+		if (scull_fifo_mode != SCULL_FIFO_MODE_LOCKFREE)
+			return -ENODEV;
+		if (arg == SCULL_WAIT_FULL)
+			wake_up_interruptible_poll(&dev->full_wq,
+					EPOLLIN | EPOLLRDNORM);
+		else if (arg == SCULL_WAIT_EMPTY)
+			wake_up_interruptible_poll(&dev->empty_wq,
+					EPOLLOUT | EPOLLWRNORM);
+		else
+			return -EINVAL;
+		break;
+
+	case SCULL_IOCGSTATS:
+		stats = kmalloc(sizeof(*stats), GFP_KERNEL);
+		if (!stats)
+			return -ENOMEM;
+		scull_stats_sum(dev, stats);
+		if (copy_to_user((void __user *)arg, stats, sizeof(*stats)))
+			retval = -EFAULT;
+		kfree(stats);
+		break;
+
+	default:  /* redundant, as cmd was checked against MAXNR */
+		return -ENOTTY;
+	}
+	return retval;
+
+}
+
+
+struct file_operations scull_fops = {
+	.owner 		= THIS_MODULE,
+	.unlocked_ioctl = scull_ioctl,
+	.open 		= scull_open,
+	.release	= scull_release,
+	.read_iter	= scull_read_iter,
+	.write_iter	= scull_write_iter,
+	.splice_read	= splice_read_wrapper,
+	.splice_write	= iter_file_splice_write,
+	.mmap		= scull_mmap,
+	.poll		= scull_poll,
+};
+
+/*
+ * debugfs: scull/scull<minor> shows the same numbers as SCULL_IOCGSTATS,
+ * with only the histogram buckets that have something in them.
+ */
+static struct dentry *scull_debugfs;
+
+static void scull_stats_show_hist(struct seq_file *m, const char *name,
+		const u64 *hist)
+{
+	int i;
+
+	seq_printf(m, "%s (log2 ns):\n", name);
+	for (i = 0; i < SCULL_HIST_BUCKETS; i++)
+		if (hist[i])
+			seq_printf(m, "  %2d %llu\n", i, hist[i]);
+}
+
+static int scull_stats_show(struct seq_file *m, void *v)
+{
+	struct scull_dev *dev = m->private;
+	struct scull_stats *st;
+
+	st = kmalloc(sizeof(*st), GFP_KERNEL);
+	if (!st)
+		return -ENOMEM;
+	scull_stats_sum(dev, st);
+
+	seq_printf(m, "enqueued %llu\n", st->enqueued);
+	seq_printf(m, "dequeued %llu\n", st->dequeued);
+	seq_printf(m, "bytes_in %llu\n", st->bytes_in);
+	seq_printf(m, "bytes_out %llu\n", st->bytes_out);
+	seq_printf(m, "truncated %llu\n", st->truncated);
+	seq_printf(m, "dropped %llu\n", st->dropped);
+	seq_printf(m, "overruns %llu\n", st->overruns);
+	seq_printf(m, "spilled %llu\n", st->spilled);
+	seq_printf(m, "spill_bytes %llu\n", st->spill_bytes);
+	seq_printf(m, "spill_queued %llu\n", scull_spill_queued(dev));
+	seq_printf(m, "full_waits %llu\n", st->full_waits);
+	seq_printf(m, "full_wait_ns %llu\n", st->full_wait_ns);
+	seq_printf(m, "empty_waits %llu\n", st->empty_waits);
+	seq_printf(m, "empty_wait_ns %llu\n", st->empty_wait_ns);
+	seq_printf(m, "spin_hits %llu\n", st->spin_hits);
+	seq_printf(m, "spin_misses %llu\n", st->spin_misses);
+	seq_printf(m, "sem_waits %llu\n", st->sem_waits);
+	seq_printf(m, "sem_wait_ns %llu\n", st->sem_wait_ns);
+	seq_printf(m, "max_occupancy %llu\n", st->max_occupancy);
+	scull_stats_show_hist(m, "read_ns", st->read_ns);
+	scull_stats_show_hist(m, "write_ns", st->write_ns);
+	scull_stats_show_hist(m, "residence_ns", st->residence_ns);
+
+	kfree(st);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(scull_stats);
+
+/*
+ * Finally, the module stuff
+ */
+
+/*
+ * The cleanup function is used to handle initialization failures as well.
+ * Thefore, it must be careful to work correctly even if some of the items
+ * have not been initialized
+ */
+void scull_cleanup_module(void)
+{
+	dev_t devno = MKDEV(scull_major, scull_minor);
+	int i;
+
+	/* the stats files point into the devices */
+	debugfs_remove_recursive(scull_debugfs);
+
+	if (scull_devices) {
+		for (i = 0; i < scull_nr_devs; i++) {
+			struct scull_dev *dev = &scull_devices[i];
+
+			/* only devices that got a FIFO had their cdev set up */
+			if (!dev->ctl)
+				continue;
+			/* Get rid of the char dev entry */
+			cdev_del(&dev->cdev);
+			/* Free FIFO safely */
+			scull_fifo_free(dev);
+		}
+		kfree(scull_devices);
+	}
+
+	/* cleanup_module is never called if registering failed */
+	unregister_chrdev_region(devno, scull_nr_devs);
+}
+
+/*
+ * Set up the FIFO and the char_dev structure for one device; the FIFO is
+ * allocated before the device goes live.
+ */
+static int scull_setup_dev(struct scull_dev *dev, int index)
+{
+	int err, devno = MKDEV(scull_major, scull_minor + index);
+	char name[16];
+
+	dev->index = index;
+	err = scull_fifo_alloc(dev);
+	if (err)
+		return err;
+
+	cdev_init(&dev->cdev, &scull_fops);
+	dev->cdev.owner = THIS_MODULE;
+	err = cdev_add (&dev->cdev, devno, 1);
+	/* Fail gracefully if need be */
+	if (err) {
+		printk(KERN_NOTICE "Error %d adding scull%d", err, index);
+		/* no ctl tells cleanup there is no cdev to delete either */
+		scull_fifo_free(dev);
+		return err;
+	}
+
+	/* no stats file is no reason to fail */
+	snprintf(name, sizeof(name), "scull%d", index);
+	debugfs_create_file(name, 0444, scull_debugfs, dev, &scull_stats_fops);
+	return 0;
+}
+
+
+int scull_init_module(void)
+{
+	int result, i;
+	dev_t dev = 0;
+
+	if (scull_fifo_size <= 0 || scull_fifo_elemsz <= 0 ||
+	    scull_nr_devs <= 0 || scull_fifo_msgsz < 0 ||
+	    /* fragments are consecutive slots of the one locked ring */
+	    (scull_fifo_msgsz > scull_fifo_elemsz &&
+	     (scull_fifo_mode != SCULL_FIFO_MODE_LOCKED ||
+	      DIV_ROUND_UP(scull_fifo_msgsz, scull_fifo_elemsz) >
+	      scull_fifo_size)) ||
+	    scull_nr_lanes <= 0 || scull_nr_lanes > SCULL_LANES_MAX ||
+	    scull_fifo_policy < SCULL_POLICY_BLOCK ||
+	    scull_fifo_policy > SCULL_POLICY_SPILL ||
+	    (scull_fifo_policy == SCULL_POLICY_SPILL &&
+	     (!scull_spill_dir || !*scull_spill_dir)) ||
+	    scull_spin_us < 0 || scull_spin_us > SCULL_SPIN_MAX_US ||
+	    scull_fifo_layout < SCULL_LAYOUT_PACKED ||
+	    scull_fifo_layout > SCULL_LAYOUT_SPLIT ||
+	    scull_fifo_mode < SCULL_FIFO_MODE_LOCKED ||
+	    scull_fifo_mode > SCULL_FIFO_MODE_PRIO) {
+		printk(KERN_WARNING "scull: bad FIFO parameters\n");
+		return -EINVAL;
+	}
+
+	/*
+	 * Get a range of minor numbers to work with, asking for a dynamic
+	 * major unless directed otherwise at load time.
+	 */
+	if (scull_major) {
+		dev = MKDEV(scull_major, scull_minor);
+		result = register_chrdev_region(dev, scull_nr_devs, "scull");
+	} else {
+		result = alloc_chrdev_region(&dev, scull_minor, scull_nr_devs,
+				"scull");
+		scull_major = MAJOR(dev);
+	}
+	if (result < 0) {
+		printk(KERN_WARNING "scull: can't get major %d\n", scull_major);
+		return result;
+	}
+
+	scull_devices = kcalloc(scull_nr_devs, sizeof(struct scull_dev),
+			GFP_KERNEL);
+	if (!scull_devices) {
+		result = -ENOMEM;
+		goto fail;  /* Make this more graceful */
+	}
+
+	scull_debugfs = debugfs_create_dir("scull", NULL);
+	for (i = 0; i < scull_nr_devs; i++) {
+		result = scull_setup_dev(&scull_devices[i], i);
+		if (result)
+			goto fail;
+	}
+
+	printk(KERN_INFO "scull: %d FIFOs, SIZE=%u, ELEMSZ=%u, MSGSZ=%zu, "
+			"MODE=%d\n", scull_nr_devs, scull_fifo_size,
+			scull_fifo_elemsz, scull_msg_max(), scull_fifo_mode);
+	return 0; /* succeed */
+
+  fail:
+	scull_cleanup_module();
+	return result;
+}
+
+module_init(scull_init_module);
+module_exit(scull_cleanup_module);
@@ -19,12 +19,17 @@
 #define _SCULL_H_
 
 #include <linux/ioctl.h> /* needed for the _IOW etc stuff used later */
+#include <linux/types.h> /* __u32 etc for the shared ring layout */
 
 
 #ifndef SCULL_MAJOR
 #define SCULL_MAJOR 0   /* dynamic major by default */
 #endif
 
+#ifndef SCULL_NR_DEVS
+#define SCULL_NR_DEVS 4    /* scull0 through scull3 */
+#endif
+
 
 /*
  * SCULL_FIFO_SIZE_DEFAULT
@@ -40,7 +45,227 @@
 #define SCULL_FIFO_ELEMSZ_DEFAULT 256
 #endif
 
+/*
+ * SCULL_FIFO_MODE_* - ring implementation, picked by scull_fifo_mode
+ * LOCKED   - start/end guarded by one semaphore (default)
+ * LOCKFREE - multi-producer/multi-consumer ring with per-slot sequence
+ *            numbers; full/empty still provide the blocking
+ * BYTES    - records packed back to back as header + payload in a byte
+ *            ring with room for size records of SIZE, guarded like LOCKED
+ * SHARDED  - one locked ring of size slots per possible CPU; each writer
+ *            thread keeps to one, readers steal across them. Only one
+ *            thread's elements are kept in order relative to each other
+ * PRIO     - scull_nr_lanes locked rings (lanes), each with its own
+ *            capacity; a write goes to its fd's lane (SCULL_IOCSPRIO) and
+ *            a read always takes from the most urgent lane that has
+ *            anything. Order is kept within a lane
+ */
+#define SCULL_FIFO_MODE_LOCKED   0
+#define SCULL_FIFO_MODE_LOCKFREE 1
+#define SCULL_FIFO_MODE_BYTES    2
+#define SCULL_FIFO_MODE_SHARDED  3
+#define SCULL_FIFO_MODE_PRIO     4
+
+/*
+ * Fragmentation (LOCKED mode only) - scull_fifo_msgsz is the largest
+ * element a write makes, in bytes; 0 (the default) means SIZE, and
+ * anything longer is truncated as ever. Above SIZE, an element takes as
+ * many consecutive slots as it needs, all committed at once under the
+ * semaphore: the first slot's header has the whole length and stamp, and
+ * the payload runs on through the following slots. Reads hand it back
+ * whole, and fail with -EMSGSIZE, leaving it queued, if the buffer is too
+ * small for it; SCULL_IOCGNEXTLEN tells how big it is. full then counts
+ * elements and empty slots, and the FIFO can't shrink below one element
+ * of scull_fifo_msgsz.
+ */
+
+/*
+ * SCULL_NR_LANES - PRIO mode lanes, 0 the most urgent; at most
+ * SCULL_LANES_MAX. Lane i holds scull_lane_size[i] elements, or
+ * scull_fifo_size if that isn't given.
+ */
+#ifndef SCULL_NR_LANES
+#define SCULL_NR_LANES 4
+#endif
+#define SCULL_LANES_MAX 16
+
+/*
+ * SCULL_POLICY_* - what a write does when the FIFO (or its shard or lane)
+ * is full; scull_fifo_policy at load time, SCULL_IOCSPOLICY per device
+ * BLOCK     - wait for room, or -EAGAIN with O_NONBLOCK (default)
+ * DROP      - drop the new element and fail with -ENOSPC
+ * OVERWRITE - throw away the oldest element to make room
+ * SPILL     - append the new element to the device's file in
+ *             scull_spill_dir, to be read back in order once the FIFO
+ *             drains; only with scull_spill_dir set at load time
+ * Dropped and overwritten elements are counted as lost, see
+ * SCULL_IOCGLOST. Writers through the mmap()ed ring always block.
+ */
+#define SCULL_POLICY_BLOCK     0
+#define SCULL_POLICY_DROP      1
+#define SCULL_POLICY_OVERWRITE 2
+#define SCULL_POLICY_SPILL     3
+
+/*
+ * Busy-polling - how long a read or write that would block first spins
+ * on the FIFO instead, in µs; scull_spin_us at load time, SCULL_IOCSSPIN
+ * per device. 0 (the default) sleeps right away. Worth it when the other
+ * side keeps up closely and a sleep/wakeup costs more than the wait, as
+ * spin_hits vs spin_misses in the statistics show. Capped at
+ * SCULL_SPIN_MAX_US.
+ */
+#define SCULL_SPIN_MAX_US 1000000
+
+/*
+ * SCULL_LAYOUT_* - how the slot modes (locked, lock-free, sharded, prio)
+ * lay out their slots; scull_fifo_layout at load time
+ * PACKED - each slot's struct scull_elem_hdr right in front of its
+ *          payload, 8-byte aligned (default)
+ * SPLIT  - all headers together in one compact array, then the payloads,
+ *          each starting on its own SCULL_CACHELINE. A writer filling one
+ *          slot then never dirties a line a reader of the next is copying
+ *          out, and lengths can be scanned without touching payloads, at
+ *          the price of padding every payload to a whole line.
+ * The byte ring packs variable-sized records and ignores this.
+ */
+#define SCULL_LAYOUT_PACKED 0
+#define SCULL_LAYOUT_SPLIT  1
+
+/* the line size the shared layouts are padded to, whatever the CPU's */
+#define SCULL_CACHELINE 64
+
+
+/*
+ * Shared ring (lock-free mode only)
+ *
+ * mmap() of the device maps one area laid out as
+ *   [struct scull_ring_ctl, padded to a page]
+ *   [__u64 seq[size] at seq_off]
+ *   [size slots]
+ * and the driver's own read()/write() use the same area, so user space
+ * and syscall users share one FIFO. Whatever the layout, slot i's
+ * struct scull_elem_hdr is at hdr_off + i * hdrsz and its payload at
+ * data_off + i * slotsz.
+ *
+ * Positions are free-running; position p lives in slot p % size.
+ * seq[i] == p      slot i is free for the writer of position p
+ * seq[i] == p + 1  slot i holds position p, ready for its reader
+ *
+ * full/empty work like counting semaphores. Take a credit by decrementing
+ * while positive; if there is none, SCULL_IOCWAIT sleeps in the driver and
+ * returns once it has taken the credit for you. After giving a credit back
+ * (increment), call SCULL_IOCWAKE if the matching *_waiters or pollers is
+ * nonzero. Only then fetch-and-add head (reader) or tail (writer) to get a
+ * position.
+ */
+#ifdef __KERNEL__
+typedef atomic_t	scull_atomic_t;
+typedef atomic64_t	scull_atomic64_t;
+#else
+typedef __s32		scull_atomic_t;
+typedef __u64		scull_atomic64_t;
+#endif
+
+#define SCULL_CACHELINE_ALIGNED __attribute__((aligned(SCULL_CACHELINE)))
+
+/*
+ * Readers hammer head and writers tail, so each gets a line of its own,
+ * and neither shares one with the counters below.
+ */
+struct scull_ring_ctl {
+	scull_atomic64_t head SCULL_CACHELINE_ALIGNED;	/* next to consume */
+	scull_atomic64_t tail SCULL_CACHELINE_ALIGNED;	/* next to produce */
+	scull_atomic_t full SCULL_CACHELINE_ALIGNED;	/* filled slots no
+							 * reader has claimed */
+	scull_atomic_t empty;		/* free slots no writer has claimed */
+	scull_atomic_t full_waiters;	/* readers asleep in SCULL_IOCWAIT */
+	scull_atomic_t empty_waiters;	/* writers asleep in SCULL_IOCWAIT */
+	scull_atomic_t pollers;		/* open files that have poll()ed */
+	__u32 size;			/* N */
+	__u32 elemsz;			/* SIZE */
+	__u32 layout;			/* SCULL_LAYOUT_* */
+	__u32 hdrsz;			/* from one slot's header to the next */
+	__u32 slotsz;			/* from one slot's payload to the next */
+	__u32 seq_off;
+	__u32 hdr_off;
+	__u32 data_off;
+	__u32 map_size;			/* whole area, what mmap() takes */
+};
+
+/*
+ * Every element, in every mode, is stored as this header followed by the
+ * payload. stamp is when it was enqueued, in CLOCK_MONOTONIC nanoseconds;
+ * mappers set it from clock_gettime() when they commit.
+ */
+struct scull_elem_hdr {
+	__s32 len;
+	__u32 pad;
+	__u64 stamp;
+};
+
+/* slot length that a faulted writer leaves behind; readers skip it */
+#define SCULL_SLOT_POISON (-1)
+
+/*
+ * Framed read/write (SCULL_IOCSFRAMED): every record in the buffer is a
+ * native-endian __u32 length followed by that many payload bytes.
+ */
+#define SCULL_FRAME_HDR sizeof(__u32)
+
+/*
+ * Stamped reads (SCULL_IOCSSTAMPED): every element read is preceded by
+ * this, before its framed length header if there is one.
+ */
+struct scull_stamp {
+	__u64 enqueued;		/* scull_elem_hdr.stamp */
+	__u64 residence;	/* ns it spent queued */
+};
+
+/* arguments to SCULL_IOCWAIT / SCULL_IOCWAKE */
+#define SCULL_WAIT_FULL  0
+#define SCULL_WAIT_EMPTY 1
+
+
+
+/*
+ * Statistics, summed over all CPUs by SCULL_IOCGSTATS and shown in
+ * debugfs as scull/scull<minor>. A wait is counted when a caller had to
+ * sleep for an element (full), for room (empty) or for the lock (sem, or
+ * the shard's or lane's lock); *_wait_ns is the time it slept.
+ * read_ns/write_ns are log2 histograms of how long successful reads and
+ * writes took, blocking included: bucket i counts [2^i, 2^(i+1)) ns and
+ * the last one everything longer. Occupancy is sampled after each enqueue,
+ * in bytes in BYTES mode and per shard or lane in SHARDED and PRIO mode.
+ * residence_ns is the same kind of histogram of the time from enqueue to
+ * dequeue.
+ * Elements that go through the mmap()ed ring without a syscall aren't
+ * counted.
+ */
+#define SCULL_HIST_BUCKETS 32
 
+struct scull_stats {
+	__u64 enqueued;
+	__u64 dequeued;
+	__u64 bytes_in;
+	__u64 bytes_out;
+	__u64 truncated;	/* writes longer than an element */
+	__u64 dropped;		/* new elements lost, DROP policy */
+	__u64 overruns;		/* old elements lost, OVERWRITE policy */
+	__u64 spilled;		/* elements written to the spill file */
+	__u64 spill_bytes;	/* and the bytes that took there */
+	__u64 full_waits;	/* blocked consumers, after any spinning */
+	__u64 full_wait_ns;
+	__u64 empty_waits;	/* blocked producers */
+	__u64 empty_wait_ns;
+	__u64 spin_hits;	/* waits busy-polling saved */
+	__u64 spin_misses;	/* spun the whole window, then slept */
+	__u64 sem_waits;
+	__u64 sem_wait_ns;
+	__u64 max_occupancy;	/* high-water mark */
+	__u64 read_ns[SCULL_HIST_BUCKETS];
+	__u64 write_ns[SCULL_HIST_BUCKETS];
+	__u64 residence_ns[SCULL_HIST_BUCKETS];
+};
 
 /*
  * Ioctl definitions
@@ -55,11 +280,38 @@
 /*
  * IOCTLs
  * GETELEMSZ - Get Element Size
- * SETSIZE - Set FIFO size (# of elements) (bonus)
+ * SETSIZE - Set FIFO size (# of elements), keeping what is queued
+ * GETMAPSZ - Get the length to mmap() (lock-free mode)
+ * WAIT - Sleep until a full/empty credit is taken for the caller
+ * WAKE - Wake one sleeper after giving back a full/empty credit
+ * SFRAMED - Tell whether reads/writes on this fd are framed batches
+ * GSTATS - Get the device's struct scull_stats
+ * SSTAMPED - Tell whether reads on this fd return struct scull_stamp too
+ * SPRIO - Tell the lane writes on this fd go to (PRIO mode); the default
+ *         is the last, least urgent one
+ * SPOLICY - Tell the device's full policy, a SCULL_POLICY_*
+ * GLOST - Query how many elements the device lost since this fd's last
+ *         successful read (or its open)
+ * SSPIN - Tell the device's busy-poll window in µs, 0 to just sleep
+ * GMSGSZ - Get the largest element a write makes (scull_fifo_msgsz)
+ * GNEXTLEN - Query the length of the oldest element, 0 if there is none
+ *            (LOCKED and BYTES mode)
  */
 #define SCULL_IOCGETELEMSZ _IO(SCULL_IOC_MAGIC,  1)
 #define SCULL_IOCSETSIZE   _IO(SCULL_IOC_MAGIC,  2)
+#define SCULL_IOCGETMAPSZ  _IO(SCULL_IOC_MAGIC,  3)
+#define SCULL_IOCWAIT      _IO(SCULL_IOC_MAGIC,  4)
+#define SCULL_IOCWAKE      _IO(SCULL_IOC_MAGIC,  5)
+#define SCULL_IOCSFRAMED   _IO(SCULL_IOC_MAGIC,  6)
+#define SCULL_IOCGSTATS    _IOR(SCULL_IOC_MAGIC, 7, struct scull_stats)
+#define SCULL_IOCSSTAMPED  _IO(SCULL_IOC_MAGIC,  8)
+#define SCULL_IOCSPRIO     _IO(SCULL_IOC_MAGIC,  9)
+#define SCULL_IOCSPOLICY   _IO(SCULL_IOC_MAGIC, 10)
+#define SCULL_IOCGLOST     _IO(SCULL_IOC_MAGIC, 11)
+#define SCULL_IOCSSPIN     _IO(SCULL_IOC_MAGIC, 12)
+#define SCULL_IOCGMSGSZ    _IO(SCULL_IOC_MAGIC, 13)
+#define SCULL_IOCGNEXTLEN  _IO(SCULL_IOC_MAGIC, 14)
 
-#define SCULL_IOC_MAXNR 2
+#define SCULL_IOC_MAXNR 14
 
 #endif /* _SCULL_H_ */
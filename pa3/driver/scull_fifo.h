@@ -0,0 +1,165 @@
+/*
+ * scull_fifo.h -- the FIFO core, shared by the module and the user-space build
+ *
+ * Copyright (C) 2001 Alessandro Rubini and Jonathan Corbet
+ * Copyright (C) 2001 O'Reilly & Associates
+ *
+ * The source code in this file can be freely used, adapted,
+ * and redistributed in source or binary form, so long as an
+ * acknowledgment appears in derived source files.  The citation
+ * should list that the code comes from the book "Linux Device
+ * Drivers" by Alessandro Rubini and Jonathan Corbet, published
+ * by O'Reilly & Associates.   No warranty is attached;
+ * we cannot take responsibility for errors or fitness for use.
+ *
+ */
+
+/*
+ * fifo.c holds the rings: getting elements in and out in every mode, the
+ * blocking, the statistics, allocation and resizing. It never sees a
+ * struct file; main.c maps the file operations onto it. Compiled without
+ * __KERNEL__, the kernel interfaces it uses come from uscull.h instead,
+ * see pa3/stress.
+ */
+
+#ifndef _SCULL_FIFO_H_
+#define _SCULL_FIFO_H_
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>	/* printk() */
+#include <linux/types.h>	/* size_t */
+#include <linux/slab.h>		/* kmalloc() */
+#include <linux/vmalloc.h>	/* vmalloc_user() */
+#include <linux/mm.h>		/* PAGE_ALIGN() */
+#include <linux/errno.h>	/* error codes */
+#include <linux/atomic.h>
+#include <linux/sched.h>	/* cond_resched() */
+#include <linux/semaphore.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>		/* wait queues */
+#include <linux/fs.h>		/* READ, filp_open() */
+#include <linux/falloc.h>	/* FALLOC_FL_PUNCH_HOLE */
+#include <linux/err.h>		/* IS_ERR() */
+#include <linux/uio.h>		/* iov_iter */
+#include <linux/poll.h>		/* EPOLLIN */
+#include <linux/percpu-rwsem.h>	/* resize vs lock-free ops */
+#include <linux/percpu.h>	/* alloc_percpu() */
+#include <linux/ktime.h>	/* ktime_get_ns() */
+#include <linux/log2.h>		/* ilog2() */
+#include <linux/cdev.h>
+#else
+#include "uscull.h"		/* user-space stand-ins for the above */
+#endif
+
+#include "scull.h"
+
+/* module parameters the core needs, in main.c */
+extern int scull_fifo_elemsz;
+extern int scull_fifo_msgsz;
+extern int scull_fifo_size;
+extern int scull_fifo_mode;
+extern int scull_fifo_policy;
+extern int scull_fifo_layout;
+extern int scull_nr_lanes;
+extern int scull_lane_size[SCULL_LANES_MAX];
+extern int scull_spin_us;
+extern char *scull_spill_dir;
+
+/*
+ * One FIFO per minor. Every device starts out with scull_fifo_size slots
+ * and can be resized on its own; SIZE and the mode are the same for all.
+ */
+struct scull_dev {
+	/*
+	 * Slots are laid out as scull_fifo_layout says, see fifo.c. The
+	 * locked ring's cursors are ctl->head and ctl->tail modulo size.
+	 */
+	char* FIFO_arr; 
+	int size;			/* N, in elements */
+	size_t fifo_bytes;		/* byte ring capacity */
+	/*
+	 * ctl holds head/tail and the full/empty counters in every mode and
+	 * stays put for the life of the module, so sleepers on it survive a
+	 * resize. In lock-free mode it is a vmalloc_user() page, and seq and
+	 * FIFO_arr share a second vmalloc_user() area; mmap() shows the two
+	 * as one ring laid out as struct scull_ring_ctl in scull.h describes.
+	 */
+	struct scull_ring_ctl *ctl;
+	u64 *seq;
+	size_t map_size;		/* what mmap() may take, ctl has a copy */
+	/*
+	 * Lock-free ops hold resize_rwsem for read from claiming a position
+	 * to publishing it, so SCULL_IOCSETSIZE can swap the ring under the
+	 * write side. maps counts live mappings; resizing those is refused.
+	 */
+	struct percpu_rw_semaphore resize_rwsem;
+	atomic_t maps;
+	wait_queue_head_t full_wq;	/* readers and pollers of ctl->full */
+	wait_queue_head_t empty_wq;	/* writers and pollers of ctl->empty */
+	struct semaphore sem;		/* locked and byte ring, resize */
+	struct scull_shard *shards;	/* sharded and prio mode, in fifo.c */
+	struct scull_spill *spill;	/* SPILL policy overflow, in fifo.c */
+	int nr_shards;
+	struct scull_stats __percpu *stats;
+	int policy;			/* SCULL_POLICY_* when full */
+	atomic64_t lost;		/* dropped + overwritten, ever */
+	u64 spin_ns;			/* busy-poll window before sleeping */
+	struct cdev cdev;		/* Char device structure		*/
+	int index;			/* scull<index>, for messages */
+};
+
+
+/*
+ * Statistics
+ *
+ * Kept per CPU, so the hot path only ever touches its own CPU's copy;
+ * scull_stats_sum() adds them up.
+ */
+#define scull_stat_inc(dev, field)	this_cpu_inc((dev)->stats->field)
+#define scull_stat_add(dev, field, v)	this_cpu_add((dev)->stats->field, v)
+
+/* account for one sleep that started at t0 */
+#define scull_stat_wait(dev, which, t0) do {				\
+		scull_stat_inc(dev, which##_waits);			\
+		scull_stat_add(dev, which##_wait_ns, ktime_get_ns() - (t0)); \
+	} while (0)
+
+static inline int scull_hist_bucket(u64 ns)
+{
+	return min_t(int, ilog2(ns | 1), SCULL_HIST_BUCKETS - 1);
+}
+
+
+/* what scull_get() puts in front of each payload, in this order */
+#define SCULL_GET_STAMPED	0x1	/* struct scull_stamp */
+#define SCULL_GET_FRAMED	0x2	/* __u32 length */
+
+/* how many bytes that is */
+static inline size_t scull_out_hdr(unsigned int fmt)
+{
+	return (fmt & SCULL_GET_STAMPED ? sizeof(struct scull_stamp) : 0) +
+	       (fmt & SCULL_GET_FRAMED ? SCULL_FRAME_HDR : 0);
+}
+
+/*
+ * Prototypes for the core. Everything may sleep, and returns -EAGAIN
+ * instead when !block. lane is the PRIO mode lane of the caller's file,
+ * ignored in the other modes. scull_get() with more == true leaves an
+ * element that doesn't fit whole queued and fails with -EMSGSIZE.
+ */
+ssize_t scull_get(struct scull_dev *dev, struct iov_iter *to,
+		unsigned int fmt, bool more, bool block);
+ssize_t scull_put(struct scull_dev *dev, struct iov_iter *from,
+		size_t count, int lane, bool block);
+int scull_full_take(struct scull_dev *dev, bool block);
+int scull_empty_take(struct scull_dev *dev, bool block);
+__poll_t scull_ready(struct scull_dev *dev, int lane);
+int scull_resize(struct scull_dev *dev, int new_size);
+void scull_stats_sum(struct scull_dev *dev, struct scull_stats *sum);
+u64 scull_spill_queued(struct scull_dev *dev);
+size_t scull_msg_max(void);
+int scull_next_len(struct scull_dev *dev);
+int scull_fifo_alloc(struct scull_dev *dev);
+void scull_fifo_free(struct scull_dev *dev);
+
+#endif /* _SCULL_FIFO_H_ */
@@ -0,0 +1,16 @@
+/*
+ * @file splice_version.h
+ * @date 10/18/2026
+ *
+ */
+
+#include <linux/version.h>
+#include <linux/fs.h>
+#include <linux/splice.h>
+
+/* 6.5 dropped generic_file_splice_read() for copy_splice_read() */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,5,0)
+#define splice_read_wrapper generic_file_splice_read
+#else
+#define splice_read_wrapper copy_splice_read
+#endif
@@ -0,0 +1,17 @@
+/*
+ * @file vm_flags_version.h
+ * @date 10/18/2026
+ *
+ */
+
+#include <linux/version.h>
+#include <linux/mm.h>
+
+/* 6.3 made vma->vm_flags const, to be changed through vm_flags_set() */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,3,0)
+#define vm_flags_set_wrapper(vma,flags) \
+	((vma)->vm_flags |= (flags))
+#else
+#define vm_flags_set_wrapper(vma,flags) \
+	vm_flags_set(vma, flags)
+#endif
@@ -6,28 +6,58 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <poll.h>
 
 #include "scull.h"
+#include "scull_ring.h"
+#include "scull_bench.h"
 
-#define CDEV_NAME "/dev/scull"
+#define CDEV_NAME "/dev/scull0"
 #define MAX_CONCURRENCY 20
+#define MAX_BATCH 256
 
+/* FIFO device to use, $SCULL_DEV overrides CDEV_NAME */
+static const char *g_cdev = CDEV_NAME;
 /* Command-line option for concurrency */
 static int g_concurrency = 0;
+/* Command-line option for elements per framed read/write */
+static int g_batch = 0;
+/* Command-line options for the benchmark */
+static long g_count = 0;
+static int g_msgsz = 0;
+static int g_secs = 0;
 
 static void usage(const char *cmd) {
 	printf("Usage: %s <command>\n"
 	       "Commands:\n"
 	       "  p <int>    Use <int> processes to concurrently consume data\n"
 	       "                  MIN: 1, MAX: %d\n"
-	       "  h          Print this message\n",
-	       cmd, MAX_CONCURRENCY);
+	       "  m <int>    Like p, but consume in place through mmap()\n"
+	       "                  (driver loaded with scull_fifo_mode=1)\n"
+	       "  b <int>    Consume <int> elements with framed batches\n"
+	       "                  MIN: 1, MAX: %d\n"
+	       "  e <int>    Consume <int> elements from one epoll loop\n"
+	       "                  MIN: 1, MAX: %d\n"
+	       "  t <int>    Consume <int> elements, with how long each was queued\n"
+	       "             and how many were lost to the full policy before it\n"
+	       "                  MIN: 1, MAX: %d\n"
+	       "  B <procs> <count> <size> [<secs>]\n"
+	       "             Benchmark: <procs> processes each consume <count>\n"
+	       "             messages of <size> bytes (MIN: 8), or for <secs>\n"
+	       "             seconds when <count> is 0; prints CSV\n"
+	       "  h          Print this message\n"
+	       "Environment:\n"
+	       "  SCULL_DEV  FIFO device to use (default: %s)\n",
+	       cmd, MAX_CONCURRENCY, MAX_BATCH, MAX_BATCH, MAX_BATCH, CDEV_NAME);
 }
 
 static int do_procs(int fd) {
 	int i, status, ret = 0;
 	pid_t pid;
-	int elems = ioctl(fd, SCULL_IOCGETELEMSZ);
+	int elems = ioctl(fd, SCULL_IOCGMSGSZ);
 	char* buf = (char*)malloc((elems+1)*sizeof(char));
 	int count;
 
@@ -60,6 +90,211 @@ static int do_procs(int fd) {
 	return ret;
 }
 
+static int do_mmap_procs(int fd) {
+	int i, status, ret = 0;
+	pid_t pid;
+	struct scull_ring ring;
+	struct ring_ref ref;
+	char *slot;
+	int len;
+
+	if(ring_map(&ring, fd) < 0) {
+		perror("mmap");
+		return -1;
+	}
+
+	for(i = 0; i < g_concurrency; i++) {
+		pid = fork();
+		if(pid == 0) {
+			// Print straight out of the slot, no read() involved
+			if((slot = ring_acquire(&ring, &ref, &len)) == NULL) {
+				perror("ring_acquire");
+				exit(EXIT_FAILURE);
+			}
+			printf("read: %.*s\n", len, slot);
+			ring_release(&ring, &ref);
+			exit(EXIT_SUCCESS);
+		} else if(pid < 0) {
+			perror("cannot fork more children");
+			ret = -1;
+			break;
+		}
+	}
+	while(i-- > 0) {
+		wait(&status);
+	}
+	ring_unmap(&ring);
+
+	return ret;
+}
+
+/* Consume g_batch elements with as few framed read()s as possible */
+static int do_batch(int fd) {
+	int elems = ioctl(fd, SCULL_IOCGMSGSZ);
+	size_t size = (SCULL_FRAME_HDR + elems) * g_batch;
+	char *buf, *p;
+	ssize_t count;
+	__u32 len;
+	int got = 0;
+
+	if(elems < 0 || ioctl(fd, SCULL_IOCSFRAMED, 1) < 0)
+		return -1;
+	if((buf = malloc(size)) == NULL)
+		return -1;
+
+	while(got < g_batch) {
+		count = read(fd, buf, (SCULL_FRAME_HDR + elems) * (g_batch - got));
+		if(count < 0) {
+			perror("read");
+			break;
+		}
+		/* Walk the records: __u32 length, then the payload */
+		for(p = buf; p < buf + count; p += SCULL_FRAME_HDR + len) {
+			memcpy(&len, p, SCULL_FRAME_HDR);
+			printf("read: %.*s\n", (int)len, p + SCULL_FRAME_HDR);
+			got++;
+		}
+	}
+	free(buf);
+	return got == g_batch ? 0 : -1;
+}
+
+/* Consume g_batch elements from a single thread, never blocking in read() */
+static int do_epoll(int fd) {
+	int elems = ioctl(fd, SCULL_IOCGMSGSZ);
+	struct epoll_event ev = { .events = EPOLLIN };
+	char *buf;
+	int ep, count, got = 0;
+
+	if(elems < 0)
+		return -1;
+	if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+		return -1;
+	if((ep = epoll_create1(0)) < 0)
+		return -1;
+	if(epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0 ||
+	   (buf = malloc(elems + 1)) == NULL) {
+		close(ep);
+		return -1;
+	}
+
+	while(got < g_batch) {
+		if(epoll_wait(ep, &ev, 1, -1) < 0) {
+			perror("epoll_wait");
+			break;
+		}
+		/* Drain whatever is there, then go back to waiting */
+		while(got < g_batch && (count = read(fd, buf, elems)) >= 0) {
+			buf[count] = '\0';
+			printf("read: %s\n", buf);
+			got++;
+		}
+		if(got < g_batch && errno != EAGAIN) {
+			perror("read");
+			break;
+		}
+	}
+	free(buf);
+	close(ep);
+	return got == g_batch ? 0 : -1;
+}
+
+/* Consume g_batch elements, each read with its enqueue stamp in front */
+static int do_stamped(int fd) {
+	int elems = ioctl(fd, SCULL_IOCGMSGSZ);
+	struct scull_stamp st;
+	ssize_t count;
+	long lost;
+	char *buf;
+	int got;
+
+	if(elems < 0 || ioctl(fd, SCULL_IOCSSTAMPED, 1) < 0)
+		return -1;
+	if((buf = malloc(sizeof(st) + elems)) == NULL)
+		return -1;
+
+	for(got = 0; got < g_batch; got++) {
+		/* lost since our previous read, so before this element */
+		lost = ioctl(fd, SCULL_IOCGLOST);
+		if((count = read(fd, buf, sizeof(st) + elems)) < 0) {
+			perror("read");
+			break;
+		}
+		if(lost > 0)
+			printf("lost: %ld\n", lost);
+		memcpy(&st, buf, sizeof(st));
+		printf("read: %.*s (queued %llu ns)\n",
+		       (int)(count - sizeof(st)), buf + sizeof(st),
+		       (unsigned long long)st.residence);
+	}
+	free(buf);
+	return got == g_batch ? 0 : -1;
+}
+
+/*
+ * Benchmark: g_concurrency processes each read g_count messages into a
+ * g_msgsz buffer, or keep reading for g_secs seconds. Latency is from the
+ * send time the producer benchmark put at the start of each message.
+ */
+static int do_bench(int fd) {
+	struct bench_result *res, *r;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	__u64 t, stamp, deadline = 0;
+	int i, status, ret = 0;
+	ssize_t count;
+	long n;
+	pid_t pid;
+	char *buf;
+
+	if((res = bench_alloc(g_concurrency)) == NULL)
+		return -1;
+	if(g_secs) {
+		/* Never sleep in read(), so the deadline can't be missed */
+		if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+			return -1;
+		deadline = bench_now() + g_secs * 1000000000ULL;
+	}
+
+	for(i = 0; i < g_concurrency; i++) {
+		pid = fork();
+		if(pid == 0) {
+			r = &res[i];
+			if((buf = malloc(g_msgsz)) == NULL)
+				exit(EXIT_FAILURE);
+			for(n = 0; !g_count || n < g_count; ) {
+				if(deadline) {
+					t = bench_now();
+					if(t >= deadline ||
+					   poll(&pfd, 1, (deadline - t) / 1000000) == 0)
+						break;
+				}
+				if((count = read(fd, buf, g_msgsz)) < 0) {
+					if(errno == EAGAIN || errno == EINTR)
+						continue; /* another reader got it */
+					perror("read");
+					break;
+				}
+				t = bench_now();
+				memcpy(&stamp, buf, sizeof(stamp));
+				bench_record(r, t, t - stamp, count);
+				n++;
+			}
+			exit(EXIT_SUCCESS);
+		} else if(pid < 0) {
+			perror("cannot fork more children");
+			ret = -1;
+			break;
+		}
+	}
+	while(i-- > 0) {
+		wait(&status);
+	}
+
+	bench_report("e2e", g_concurrency, g_msgsz, res, g_concurrency);
+	bench_free(res, g_concurrency);
+	return ret;
+}
+
 typedef int cmd_t;
 
 static cmd_t parse_arguments(int argc, const char **argv) {
@@ -75,6 +310,7 @@ static cmd_t parse_arguments(int argc, const char **argv) {
 	cmd = argv[1][0];
 	switch(cmd) {
 	case 'p':
+	case 'm':
 		if(argc < 3) {
 			fprintf(stderr, "%s: Missing concurrency\n", argv[0]);
 			cmd = -1;
@@ -89,7 +325,45 @@ static cmd_t parse_arguments(int argc, const char **argv) {
 			break;
 		}
 		break;
+	case 'b':
+	case 'e':
+	case 't':
+		if(argc < 3) {
+			fprintf(stderr, "%s: Missing batch size\n", argv[0]);
+			cmd = -1;
+			break;
+		}
+		g_batch = atoi(argv[2]);
+		if(g_batch < 1 || g_batch > MAX_BATCH) {
+			fprintf(stderr, "%s: Invalid value (%d) for "
+					"batch size\n",
+					argv[0], g_batch);
+			cmd = -1;
+			break;
+		}
+		break;
 	
+	case 'B':
+		if(argc < 5) {
+			fprintf(stderr, "%s: Missing benchmark arguments\n",
+					argv[0]);
+			cmd = -1;
+			break;
+		}
+		g_concurrency = atoi(argv[2]);
+		g_count = atol(argv[3]);
+		g_msgsz = atoi(argv[4]);
+		g_secs = argc > 5 ? atoi(argv[5]) : 0;
+		if(g_concurrency < 1 || g_concurrency > MAX_CONCURRENCY ||
+		   g_count < 0 || g_secs < 0 || (!g_count && !g_secs) ||
+		   g_msgsz < (int)sizeof(__u64)) {
+			fprintf(stderr, "%s: Invalid benchmark arguments\n",
+					argv[0]);
+			cmd = -1;
+			break;
+		}
+		break;
+
 	default:
 		fprintf(stderr, "%s: Invalid command\n", argv[0]);
 		cmd = -1;
@@ -110,6 +384,21 @@ static int do_op(int fd, cmd_t cmd) {
 	case 'p':
 		ret = do_procs(fd);
 		break;
+	case 'm':
+		ret = do_mmap_procs(fd);
+		break;
+	case 'b':
+		ret = do_batch(fd);
+		break;
+	case 'e':
+		ret = do_epoll(fd);
+		break;
+	case 't':
+		ret = do_stamped(fd);
+		break;
+	case 'B':
+		ret = do_bench(fd);
+		break;
 	default:
 		/* Should never occur */
 		abort();
@@ -124,16 +413,22 @@ static int do_op(int fd, cmd_t cmd) {
 int main(int argc, const char **argv) {
 	int fd, ret;
 	cmd_t cmd;
+	FILE *log;
 
 	cmd = parse_arguments(argc, argv);
+	if(getenv("SCULL_DEV"))
+		g_cdev = getenv("SCULL_DEV");
+	/* Keep stdout to the CSV when benchmarking */
+	log = (cmd == 'B')? stderr : stdout;
 
-	fd = open(CDEV_NAME, O_RDONLY);
+	/* a shared writable mapping needs the fd open for both */
+	fd = open(g_cdev, (cmd == 'm')? O_RDWR : O_RDONLY);
 	if(fd < 0) {
 		perror("cdev open");
 		return EXIT_FAILURE;
 	}
 
-	printf("Device (%s) opened\n", CDEV_NAME);
+	fprintf(log, "Device (%s) opened\n", g_cdev);
 
 	ret = do_op(fd, cmd);
 
@@ -142,7 +437,7 @@ int main(int argc, const char **argv) {
 		return EXIT_FAILURE;
 	}
 
-	printf("Device (%s) closed\n", CDEV_NAME);
+	fprintf(log, "Device (%s) closed\n", g_cdev);
 
 	return (ret != 0)? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -6,22 +6,59 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
+#include <string.h>
+#include <errno.h>
 
 #include "scull.h"
+#include "scull_ring.h"
+#include "scull_bench.h"
 
-#define CDEV_NAME "/dev/scull"
+#define CDEV_NAME "/dev/scull0"
 #define MAX_CONCURRENCY 20
+#define MAX_BATCH 256
 
+/* FIFO device to use, $SCULL_DEV overrides CDEV_NAME */
+static const char *g_cdev = CDEV_NAME;
 /* Command-line option for concurrency */
 static int g_concurrency = 0;
+/* Command-line option for elements per framed read/write */
+static int g_batch = 0;
+/* Command-line options for the benchmark */
+static long g_count = 0;
+static int g_msgsz = 0;
+static int g_secs = 0;
+/* Command-line option for the new FIFO size */
+static int g_size = 0;
+/* Command-line option for the full policy */
+static int g_policy = 0;
+/* Command-line option for the busy-poll window */
+static int g_spin = 0;
 
 static void usage(const char *cmd) {
 	printf("Usage: %s <command>\n"
 	       "Commands:\n"
 	       "  p <int>    Use <int> processes to concurrently produce data\n"
 	       "                  MIN: 1, MAX: %d\n"
-	       "  h          Print this message\n",
-	       cmd, MAX_CONCURRENCY);
+	       "  m <int>    Like p, but produce in place through mmap()\n"
+	       "                  (driver loaded with scull_fifo_mode=1)\n"
+	       "  b <int>    Produce <int> elements with framed batches\n"
+	       "                  MIN: 1, MAX: %d\n"
+	       "  s <int>    Resize the FIFO to <int> elements, keeping its data\n"
+	       "  o <int>    Set what writes do when the FIFO is full:\n"
+	       "                  0 block, 1 drop the new element,\n"
+	       "                  2 overwrite the oldest,\n"
+	       "                  3 spill to scull_spill_dir\n"
+	       "  w <int>    Busy-poll <int> us before blocking, 0 to not\n"
+	       "  B <procs> <count> <size> [<secs>]\n"
+	       "             Benchmark: <procs> processes each produce <count>\n"
+	       "             messages of <size> bytes (MIN: 8), or for <secs>\n"
+	       "             seconds when <count> is 0; prints CSV\n"
+	       "  h          Print this message\n"
+	       "Environment:\n"
+	       "  SCULL_DEV  FIFO device to use (default: %s)\n"
+	       "  SCULL_PRIO Lane to write to, 0 the most urgent\n"
+	       "             (driver loaded with scull_fifo_mode=4)\n",
+	       cmd, MAX_CONCURRENCY, MAX_BATCH, CDEV_NAME);
 }
 
 static int do_procs(int fd) {
@@ -50,6 +87,130 @@ static int do_procs(int fd) {
 	return ret;
 }
 
+static int do_mmap_procs(int fd) {
+	int i, status, ret = 0;
+	pid_t pid;
+	struct scull_ring ring;
+	struct ring_ref ref;
+	char buf[] = "Nidhi Parekh";
+	int count = sizeof(buf) - 1; // No need to write '\0' to the FIFO
+	char *slot;
+
+	if(ring_map(&ring, fd) < 0) {
+		perror("mmap");
+		return -1;
+	}
+	if(count > (int)ring.ctl->elemsz)
+		count = ring.ctl->elemsz;
+
+	for(i = 0; i < g_concurrency; i++) {
+		pid = fork();
+		if(pid == 0) {
+			printf("write: %s\n", buf);
+			// Fill the slot in place, no write() involved
+			if((slot = ring_reserve(&ring, &ref)) == NULL) {
+				perror("ring_reserve");
+				exit(EXIT_FAILURE);
+			}
+			memcpy(slot, buf, count);
+			ring_commit(&ring, &ref, count);
+			exit(EXIT_SUCCESS);
+		} else if(pid < 0) {
+			perror("cannot fork more children");
+			ret = -1;
+			break;
+		}
+	}
+	while(i-- > 0) {
+		wait(&status);
+	}
+	ring_unmap(&ring);
+
+	return ret;
+}
+
+/* Queue g_batch elements with one framed write() */
+static int do_batch(int fd) {
+	char msg[] = "Nidhi Parekh";
+	__u32 len = sizeof(msg) - 1;
+	size_t rec = SCULL_FRAME_HDR + len;
+	char *buf, *p;
+	ssize_t count;
+	int i;
+
+	if(ioctl(fd, SCULL_IOCSFRAMED, 1) < 0)
+		return -1;
+	if((buf = malloc(rec * g_batch)) == NULL)
+		return -1;
+
+	for(i = 0, p = buf; i < g_batch; i++, p += rec) {
+		memcpy(p, &len, SCULL_FRAME_HDR);
+		memcpy(p + SCULL_FRAME_HDR, msg, len);
+	}
+	if((count = write(fd, buf, rec * g_batch)) < 0)
+		perror("write");
+	else
+		printf("write: %zd bytes, %zu elements\n", count,
+				count / rec);
+	free(buf);
+	return count < 0 ? -1 : 0;
+}
+
+/*
+ * Benchmark: g_concurrency processes each write g_count messages of
+ * g_msgsz bytes, or keep writing for g_secs seconds. Every message starts
+ * with its send time so the consumer benchmark can measure latency.
+ */
+static int do_bench(int fd) {
+	struct bench_result *res, *r;
+	__u64 t, done, deadline = 0;
+	int i, status, ret = 0;
+	ssize_t count;
+	long n;
+	pid_t pid;
+	char *buf;
+
+	if((res = bench_alloc(g_concurrency)) == NULL)
+		return -1;
+	if(g_secs)
+		deadline = bench_now() + g_secs * 1000000000ULL;
+
+	for(i = 0; i < g_concurrency; i++) {
+		pid = fork();
+		if(pid == 0) {
+			r = &res[i];
+			if((buf = calloc(1, g_msgsz)) == NULL)
+				exit(EXIT_FAILURE);
+			for(n = 0; !g_count || n < g_count; n++) {
+				t = bench_now();
+				if(deadline && t >= deadline)
+					break;
+				memcpy(buf, &t, sizeof(t));
+				if((count = write(fd, buf, g_msgsz)) < 0) {
+					if(errno == ENOSPC)
+						continue; /* dropped when full */
+					perror("write");
+					break;
+				}
+				done = bench_now();
+				bench_record(r, done, done - t, count);
+			}
+			exit(EXIT_SUCCESS);
+		} else if(pid < 0) {
+			perror("cannot fork more children");
+			ret = -1;
+			break;
+		}
+	}
+	while(i-- > 0) {
+		wait(&status);
+	}
+
+	bench_report("write", g_concurrency, g_msgsz, res, g_concurrency);
+	bench_free(res, g_concurrency);
+	return ret;
+}
+
 typedef int cmd_t;
 
 static cmd_t parse_arguments(int argc, const char **argv) {
@@ -65,6 +226,7 @@ static cmd_t parse_arguments(int argc, const char **argv) {
 	cmd = argv[1][0];
 	switch(cmd) {
 	case 'p':
+	case 'm':
 		if(argc < 3) {
 			fprintf(stderr, "%s: Missing concurrency\n", argv[0]);
 			cmd = -1;
@@ -79,6 +241,87 @@ static cmd_t parse_arguments(int argc, const char **argv) {
 			break;
 		}
 		break;
+	case 'b':
+		if(argc < 3) {
+			fprintf(stderr, "%s: Missing batch size\n", argv[0]);
+			cmd = -1;
+			break;
+		}
+		g_batch = atoi(argv[2]);
+		if(g_batch < 1 || g_batch > MAX_BATCH) {
+			fprintf(stderr, "%s: Invalid value (%d) for "
+					"batch size\n",
+					argv[0], g_batch);
+			cmd = -1;
+			break;
+		}
+		break;
+	case 's':
+		if(argc < 3) {
+			fprintf(stderr, "%s: Missing FIFO size\n", argv[0]);
+			cmd = -1;
+			break;
+		}
+		g_size = atoi(argv[2]);
+		if(g_size < 1) {
+			fprintf(stderr, "%s: Invalid value (%d) for "
+					"FIFO size\n",
+					argv[0], g_size);
+			cmd = -1;
+			break;
+		}
+		break;
+	case 'o':
+		if(argc < 3) {
+			fprintf(stderr, "%s: Missing policy\n", argv[0]);
+			cmd = -1;
+			break;
+		}
+		g_policy = atoi(argv[2]);
+		if(g_policy < SCULL_POLICY_BLOCK ||
+		   g_policy > SCULL_POLICY_SPILL) {
+			fprintf(stderr, "%s: Invalid value (%d) for "
+					"policy\n",
+					argv[0], g_policy);
+			cmd = -1;
+			break;
+		}
+		break;
+	case 'w':
+		if(argc < 3) {
+			fprintf(stderr, "%s: Missing spin window\n", argv[0]);
+			cmd = -1;
+			break;
+		}
+		g_spin = atoi(argv[2]);
+		if(g_spin < 0 || g_spin > SCULL_SPIN_MAX_US) {
+			fprintf(stderr, "%s: Invalid value (%d) for "
+					"spin window\n",
+					argv[0], g_spin);
+			cmd = -1;
+			break;
+		}
+		break;
+	case 'B':
+		if(argc < 5) {
+			fprintf(stderr, "%s: Missing benchmark arguments\n",
+					argv[0]);
+			cmd = -1;
+			break;
+		}
+		g_concurrency = atoi(argv[2]);
+		g_count = atol(argv[3]);
+		g_msgsz = atoi(argv[4]);
+		g_secs = argc > 5 ? atoi(argv[5]) : 0;
+		if(g_concurrency < 1 || g_concurrency > MAX_CONCURRENCY ||
+		   g_count < 0 || g_secs < 0 || (!g_count && !g_secs) ||
+		   g_msgsz < (int)sizeof(__u64)) {
+			fprintf(stderr, "%s: Invalid benchmark arguments\n",
+					argv[0]);
+			cmd = -1;
+			break;
+		}
+		break;
 	
 	default:
 		fprintf(stderr, "%s: Invalid command\n", argv[0]);
@@ -100,6 +343,30 @@ static int do_op(int fd, cmd_t cmd) {
 	case 'p':
 		ret = do_procs(fd);
 		break;
+	case 'm':
+		ret = do_mmap_procs(fd);
+		break;
+	case 'b':
+		ret = do_batch(fd);
+		break;
+	case 's':
+		ret = ioctl(fd, SCULL_IOCSETSIZE, g_size);
+		if(ret == 0)
+			printf("FIFO resized to %d elements\n", g_size);
+		break;
+	case 'o':
+		ret = ioctl(fd, SCULL_IOCSPOLICY, g_policy);
+		if(ret == 0)
+			printf("FIFO policy set to %d\n", g_policy);
+		break;
+	case 'w':
+		ret = ioctl(fd, SCULL_IOCSSPIN, g_spin);
+		if(ret == 0)
+			printf("FIFO spin window set to %d us\n", g_spin);
+		break;
+	case 'B':
+		ret = do_bench(fd);
+		break;
 	default:
 		/* Should never occur */
 		abort();
@@ -114,16 +381,29 @@ static int do_op(int fd, cmd_t cmd) {
 int main(int argc, const char **argv) {
 	int fd, ret;
 	cmd_t cmd;
+	FILE *log;
 
 	cmd = parse_arguments(argc, argv);
+	if(getenv("SCULL_DEV"))
+		g_cdev = getenv("SCULL_DEV");
+	/* Keep stdout to the CSV when benchmarking */
+	log = (cmd == 'B')? stderr : stdout;
 
-	fd = open(CDEV_NAME, O_WRONLY);
+	/* a shared writable mapping needs the fd open for both */
+	fd = open(g_cdev, (cmd == 'm')? O_RDWR : O_WRONLY);
 	if(fd < 0) {
 		perror("cdev open");
 		return EXIT_FAILURE;
 	}
 
-	printf("Device (%s) opened\n", CDEV_NAME);
+	fprintf(log, "Device (%s) opened\n", g_cdev);
+
+	if(getenv("SCULL_PRIO") &&
+	   ioctl(fd, SCULL_IOCSPRIO, atoi(getenv("SCULL_PRIO"))) < 0) {
+		perror("SCULL_IOCSPRIO");
+		close(fd);
+		return EXIT_FAILURE;
+	}
 
 	ret = do_op(fd, cmd);
 
@@ -132,7 +412,7 @@ int main(int argc, const char **argv) {
 		return EXIT_FAILURE;
 	}
 
-	printf("Device (%s) closed\n", CDEV_NAME);
+	fprintf(log, "Device (%s) closed\n", g_cdev);
 
 	return (ret != 0)? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,172 @@
+/*
+ * scull_bench.h -- timing, latency histograms and CSV for the benchmarks
+ *
+ * Latencies go into an HDR-style log-linear histogram: below 2 * HIST_SUB
+ * every nanosecond has its own bucket, above that each power of two is cut
+ * into HIST_SUB buckets, so any value is recorded within 1/HIST_SUB
+ * (about 1.6%) of its true value and the whole range fits in 30KB.
+ *
+ * Every benchmark process fills its own struct bench_result in a shared
+ * anonymous mapping; the parent adds them up after wait()ing for all.
+ * Rates are over the time from the first message of any process to the
+ * last, so a consumer started before its producer isn't penalized.
+ */
+
+#ifndef _SCULL_BENCH_H_
+#define _SCULL_BENCH_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <linux/types.h>
+
+#define HIST_SUB_BITS 6
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct bench_hist {
+	__u64 count;
+	__u64 max;
+	__u64 b[HIST_BUCKETS];
+};
+
+struct bench_result {
+	__u64 msgs;
+	__u64 bytes;
+	__u64 start, end;	/* first and last message, bench_now() */
+	struct bench_hist hist;
+};
+
+static inline __u64 bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int hist_index(__u64 v)
+{
+	int shift;
+
+	if(v < 2 * HIST_SUB)
+		return v;
+	shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+	return shift * HIST_SUB + (v >> shift);
+}
+
+/* highest value that lands in bucket i */
+static inline __u64 hist_value(int i)
+{
+	int shift;
+
+	if(i < 2 * HIST_SUB)
+		return i;
+	shift = i / HIST_SUB - 1;
+	return ((__u64)(i - shift * HIST_SUB) << shift) + (1ULL << shift) - 1;
+}
+
+static inline void hist_record(struct bench_hist *h, __u64 v)
+{
+	h->b[hist_index(v)]++;
+	h->count++;
+	if(v > h->max)
+		h->max = v;
+}
+
+static inline void hist_add(struct bench_hist *to, const struct bench_hist *h)
+{
+	int i;
+
+	for(i = 0; i < HIST_BUCKETS; i++)
+		to->b[i] += h->b[i];
+	to->count += h->count;
+	if(h->max > to->max)
+		to->max = h->max;
+}
+
+/* value at quantile q (0..1), 0 if nothing was recorded */
+static inline __u64 hist_quantile(const struct bench_hist *h, double q)
+{
+	__u64 rank = q * h->count + 0.5, seen = 0;
+	int i;
+
+	if(rank < 1)
+		rank = 1;
+	for(i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->b[i];
+		if(seen >= rank)
+			return hist_value(i) < h->max ? hist_value(i) : h->max;
+	}
+	return h->max;
+}
+
+/* one zeroed result per process, shared across fork() */
+static inline struct bench_result *bench_alloc(int n)
+{
+	void *p = mmap(NULL, n * sizeof(struct bench_result),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static inline void bench_free(struct bench_result *res, int n)
+{
+	munmap(res, n * sizeof(struct bench_result));
+}
+
+/* account one message of len bytes that took lat ns, finishing at now */
+static inline void bench_record(struct bench_result *r, __u64 now,
+		__u64 lat, __u64 len)
+{
+	if(!r->msgs)
+		r->start = now - lat;
+	r->end = now;
+	r->msgs++;
+	r->bytes += len;
+	hist_record(&r->hist, lat);
+}
+
+/*
+ * Print one CSV row, preceded by the header; latencies are in ns.
+ * role is what was timed: "write" for the producer's write() calls,
+ * "e2e" for the consumer's enqueue-to-dequeue latency.
+ */
+static inline void bench_report(const char *role, int procs, int size,
+		struct bench_result *res, int n)
+{
+	struct bench_result total;
+	double secs;
+	int i;
+
+	memset(&total, 0, sizeof(total));
+	for(i = 0; i < n; i++) {
+		if(!res[i].msgs)
+			continue;
+		if(!total.msgs || res[i].start < total.start)
+			total.start = res[i].start;
+		if(res[i].end > total.end)
+			total.end = res[i].end;
+		total.msgs += res[i].msgs;
+		total.bytes += res[i].bytes;
+		hist_add(&total.hist, &res[i].hist);
+	}
+	secs = total.msgs ? (total.end - total.start) / 1e9 : 0;
+	if(secs <= 0)
+		secs = 1e-9; /* keep the rates finite */
+
+	printf("role,procs,msg_size,msgs,bytes,secs,msgs_per_sec,mb_per_sec,"
+	       "p50_ns,p99_ns,p999_ns,max_ns\n");
+	printf("%s,%d,%d,%llu,%llu,%.3f,%.0f,%.2f,%llu,%llu,%llu,%llu\n",
+	       role, procs, size,
+	       (unsigned long long)total.msgs,
+	       (unsigned long long)total.bytes, secs,
+	       total.msgs / secs, total.bytes / secs / 1e6,
+	       (unsigned long long)hist_quantile(&total.hist, 0.50),
+	       (unsigned long long)hist_quantile(&total.hist, 0.99),
+	       (unsigned long long)hist_quantile(&total.hist, 0.999),
+	       (unsigned long long)total.hist.max);
+}
+
+#endif /* _SCULL_BENCH_H_ */
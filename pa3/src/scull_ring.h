@@ -0,0 +1,173 @@
+/*
+ * scull_ring.h -- user space side of the mmap()ed lock-free FIFO
+ *
+ * Slots are filled and drained in place; the only syscalls are
+ * SCULL_IOCWAIT when a full/empty credit isn't there and SCULL_IOCWAKE
+ * when someone is asleep on the credit we just gave back.
+ * The protocol is described next to struct scull_ring_ctl in scull.h.
+ */
+
+#ifndef _SCULL_RING_H_
+#define _SCULL_RING_H_
+
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "scull.h"
+
+struct scull_ring {
+	int fd;
+	struct scull_ring_ctl *ctl;
+	__u64 *seq;
+	char *hdrs;
+	char *data;
+};
+
+static inline int ring_map(struct scull_ring *r, int fd)
+{
+	long size = ioctl(fd, SCULL_IOCGETMAPSZ);
+	void *p;
+
+	if (size < 0)
+		return -1;
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		return -1;
+
+	r->fd = fd;
+	r->ctl = p;
+	r->seq = (__u64 *)((char *)p + r->ctl->seq_off);
+	r->hdrs = (char *)p + r->ctl->hdr_off;
+	r->data = (char *)p + r->ctl->data_off;
+	return 0;
+}
+
+static inline void ring_unmap(struct scull_ring *r)
+{
+	munmap(r->ctl, r->ctl->map_size);
+}
+
+static inline int ring_take(struct scull_ring *r, __s32 *credits,
+		unsigned long which)
+{
+	__s32 v = __atomic_load_n(credits, __ATOMIC_RELAXED);
+
+	while (v > 0)
+		if (__atomic_compare_exchange_n(credits, &v, v - 1, 0,
+					__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			return 0;
+	/* none left: the driver sleeps and takes one for us */
+	return ioctl(r->fd, SCULL_IOCWAIT, which);
+}
+
+static inline void ring_give(struct scull_ring *r, __s32 *credits,
+		__s32 *waiters, unsigned long which)
+{
+	__atomic_add_fetch(credits, 1, __ATOMIC_SEQ_CST);
+	/* pollers can't advertise a single wait, so they always get a wake */
+	if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST) ||
+	    __atomic_load_n(&r->ctl->pollers, __ATOMIC_SEQ_CST))
+		ioctl(r->fd, SCULL_IOCWAKE, which);
+}
+
+/* wait out the other side still using the slot of our position */
+static inline void ring_slot_wait(struct scull_ring *r, __u64 idx, __u64 seq)
+{
+	while (__atomic_load_n(&r->seq[idx], __ATOMIC_ACQUIRE) != seq)
+		sched_yield();
+}
+
+/* a claimed position, between reserve/commit or acquire/release */
+struct ring_ref {
+	__u64 pos;
+	__u64 idx;
+	struct scull_elem_hdr *hdr;
+};
+
+/* slot idx's header and payload, in whichever layout the driver uses */
+static inline struct scull_elem_hdr *ring_hdr(struct scull_ring *r, __u64 idx)
+{
+	return (struct scull_elem_hdr *)(r->hdrs + idx * r->ctl->hdrsz);
+}
+
+static inline char *ring_data(struct scull_ring *r, __u64 idx)
+{
+	return r->data + idx * r->ctl->slotsz;
+}
+
+/*
+ * Claim the next free slot and return where its payload goes
+ * (up to ctl->elemsz bytes), or NULL if the wait was interrupted.
+ */
+static inline char *ring_reserve(struct scull_ring *r, struct ring_ref *ref)
+{
+	struct scull_ring_ctl *ctl = r->ctl;
+
+	if (ring_take(r, &ctl->empty, SCULL_WAIT_EMPTY) < 0)
+		return NULL;
+
+	ref->pos = __atomic_fetch_add(&ctl->tail, 1, __ATOMIC_RELAXED);
+	ref->idx = ref->pos % ctl->size;
+	ref->hdr = ring_hdr(r, ref->idx);
+	ring_slot_wait(r, ref->idx, ref->pos);
+	return ring_data(r, ref->idx);
+}
+
+/* publish a reserved slot holding len bytes */
+static inline void ring_commit(struct scull_ring *r, struct ring_ref *ref,
+		int len)
+{
+	struct scull_ring_ctl *ctl = r->ctl;
+	struct scull_elem_hdr *hdr = ref->hdr;
+	struct timespec ts;
+
+	/* the driver's clock: ktime_get_ns() is CLOCK_MONOTONIC */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	hdr->stamp = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	hdr->len = len;
+	__atomic_store_n(&r->seq[ref->idx], ref->pos + 1, __ATOMIC_RELEASE);
+	ring_give(r, &ctl->full, &ctl->full_waiters, SCULL_WAIT_FULL);
+}
+
+/*
+ * Claim the oldest element and return its payload in place, with its
+ * length in *len, or NULL if the wait was interrupted.
+ */
+static inline char *ring_acquire(struct scull_ring *r, struct ring_ref *ref,
+		int *len)
+{
+	struct scull_ring_ctl *ctl = r->ctl;
+
+	for (;;) {
+		if (ring_take(r, &ctl->full, SCULL_WAIT_FULL) < 0)
+			return NULL;
+
+		ref->pos = __atomic_fetch_add(&ctl->head, 1, __ATOMIC_RELAXED);
+		ref->idx = ref->pos % ctl->size;
+		ref->hdr = ring_hdr(r, ref->idx);
+		ring_slot_wait(r, ref->idx, ref->pos + 1);
+
+		*len = ref->hdr->len;
+		if (*len != SCULL_SLOT_POISON)
+			return ring_data(r, ref->idx);
+		/* a writer faulted on this one: skip it */
+		__atomic_store_n(&r->seq[ref->idx], ref->pos + ctl->size,
+				__ATOMIC_RELEASE);
+		ring_give(r, &ctl->empty, &ctl->empty_waiters,
+				SCULL_WAIT_EMPTY);
+	}
+}
+
+/* hand an acquired slot back to the writers */
+static inline void ring_release(struct scull_ring *r, struct ring_ref *ref)
+{
+	struct scull_ring_ctl *ctl = r->ctl;
+
+	__atomic_store_n(&r->seq[ref->idx], ref->pos + ctl->size,
+			__ATOMIC_RELEASE);
+	ring_give(r, &ctl->empty, &ctl->empty_waiters, SCULL_WAIT_EMPTY);
+}
+
+#endif /* _SCULL_RING_H_ */
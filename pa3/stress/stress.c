@@ -0,0 +1,376 @@
+/*
+ * stress.c -- hammer the FIFO core from threads, outside the kernel
+ *
+ * fifo.c is built against uscull.h and driven straight through
+ * scull_put()/scull_get(): P producers each enqueue N numbered messages,
+ * C consumers dequeue until they see a poison message, and an optional
+ * resizer keeps changing the ring size underneath them; messages can all
+ * be the same size or vary up to it. Afterwards every (producer, seq)
+ * must have been seen exactly once, with an intact payload, and each
+ * consumer must have seen any one producer's messages in increasing
+ * order. Under the DROP and OVERWRITE policies exactly the messages the
+ * device counted as lost may be missing; under SPILL none. Build with
+ * "make SANITIZE=thread" to look for races as well.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "scull_fifo.h"
+
+/* the module parameters fifo.c reads */
+int scull_fifo_elemsz = SCULL_FIFO_ELEMSZ_DEFAULT;
+int scull_fifo_msgsz = 0;
+int scull_fifo_size = SCULL_FIFO_SIZE_DEFAULT;
+int scull_fifo_mode = SCULL_FIFO_MODE_LOCKED;
+int scull_fifo_policy = SCULL_POLICY_BLOCK;
+int scull_fifo_layout = SCULL_LAYOUT_PACKED;
+int scull_nr_lanes = SCULL_NR_LANES;
+int scull_lane_size[SCULL_LANES_MAX];
+int scull_spin_us = 0;
+char *scull_spill_dir;
+
+#define POISON UINT32_MAX
+
+struct msg {
+	__u32 producer;
+	__u32 seq;
+};
+
+static struct scull_dev g_dev;
+static int g_producers = 4;
+static int g_consumers = 4;
+static long g_count = 100000;
+static int g_msgsz = sizeof(struct msg);
+static int g_vary = 0;
+static int g_resize = 0;
+
+static unsigned char *g_seen;	/* g_producers * g_count, times seen */
+static long g_errors = 0;
+static int g_done = 0;
+
+static void usage(const char *cmd) {
+	printf("Usage: %s [options]\n"
+	       "Options:\n"
+	       "  -m <mode>  scull_fifo_mode: 0 locked, 1 lock-free, 2 bytes,\n"
+	       "             3 sharded, 4 prio (default: %d)\n"
+	       "  -s <int>   scull_fifo_size (default: %d)\n"
+	       "  -k <int>   scull_nr_lanes; producer i writes to lane i %% k\n"
+	       "             (default: %d)\n"
+	       "  -o <int>   scull_fifo_policy: 0 block, 1 drop, 2 overwrite,\n"
+	       "             3 spill (default: %d)\n"
+	       "  -f <dir>   scull_spill_dir, needed for -o 3\n"
+	       "  -L <int>   scull_fifo_layout: 0 packed, 1 split (default: %d)\n"
+	       "  -w <int>   scull_spin_us, busy-poll before sleeping\n"
+	       "             (default: %d)\n"
+	       "  -e <int>   scull_fifo_elemsz (default: %d)\n"
+	       "  -M <int>   scull_fifo_msgsz, above elemsz to fragment\n"
+	       "             (mode 0 only; default: %d)\n"
+	       "  -p <int>   Producer threads (default: %d)\n"
+	       "  -c <int>   Consumer threads (default: %d)\n"
+	       "  -n <int>   Messages per producer (default: %ld)\n"
+	       "  -l <int>   Message size, MIN: %d, MAX: elemsz or msgsz\n"
+	       "             (default: %d)\n"
+	       "  -v         Vary message sizes from MIN up to -l\n"
+	       "  -r         Resize the ring while running (not in modes 3, 4)\n"
+	       "  -h         Print this message\n",
+	       cmd, scull_fifo_mode, scull_fifo_size, scull_nr_lanes,
+	       scull_fifo_policy, scull_fifo_layout, scull_spin_us,
+	       scull_fifo_elemsz, scull_fifo_msgsz,
+	       g_producers, g_consumers, g_count, (int)sizeof(struct msg),
+	       g_msgsz);
+}
+
+static void error(const char *fmt, ...) {
+	va_list ap;
+
+	__atomic_fetch_add(&g_errors, 1, __ATOMIC_RELAXED);
+	va_start(ap, fmt);
+	fprintf(stderr, "stress: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}
+
+/* how long a message is, which with -v depends on who sent it and when */
+static int msg_len(struct msg *m) {
+	int span = g_msgsz - sizeof(*m) + 1;
+
+	if(!g_vary || m->producer == POISON)
+		return g_msgsz;
+	return sizeof(*m) + (m->producer * 7919u + m->seq * 104729u) % span;
+}
+
+/* message bytes after the header depend on who sent it and when */
+static void fill(char *buf, struct msg *m) {
+	int i;
+
+	memcpy(buf, m, sizeof(*m));
+	for(i = sizeof(*m); i < msg_len(m); i++)
+		buf[i] = m->producer * 31 + m->seq + i;
+}
+
+static int intact(const char *buf, struct msg *m) {
+	int i;
+
+	for(i = sizeof(*m); i < msg_len(m); i++)
+		if(buf[i] != (char)(m->producer * 31 + m->seq + i))
+			return 0;
+	return 1;
+}
+
+static int put(char *buf, int len, int lane) {
+	struct iov_iter it;
+	ssize_t ret;
+
+	iov_iter_buf(&it, buf, len);
+	ret = scull_put(&g_dev, &it, len, lane, true);
+	if(ret == -ENOSPC && g_dev.policy == SCULL_POLICY_DROP)
+		return 0; /* the device counts it */
+	if(ret != len) {
+		error("put returned %zd, wanted %d", ret, len);
+		return -1;
+	}
+	return 0;
+}
+
+/* account one dequeued message; last[] is this consumer's view */
+static void check(char *buf, ssize_t len, long *last) {
+	struct msg m;
+
+	if(len < (ssize_t)sizeof(m)) {
+		error("got %zd bytes, too short", len);
+		return;
+	}
+	memcpy(&m, buf, sizeof(m));
+	if(m.producer >= (__u32)g_producers || m.seq >= g_count) {
+		error("garbage message %u/%u", m.producer, m.seq);
+		return;
+	}
+	if(len != msg_len(&m)) {
+		error("got %zd bytes of %u/%u, wanted %d", len, m.producer,
+		      m.seq, msg_len(&m));
+		return;
+	}
+	if(!intact(buf, &m))
+		error("corrupt payload in %u/%u", m.producer, m.seq);
+	if(__atomic_fetch_add(&g_seen[m.producer * g_count + m.seq], 1,
+				__ATOMIC_RELAXED))
+		error("duplicate %u/%u", m.producer, m.seq);
+	if(last && (long)m.seq <= last[m.producer])
+		error("producer %u reordered, seq %u", m.producer, m.seq);
+	if(last)
+		last[m.producer] = m.seq;
+}
+
+static void *producer(void *arg) {
+	struct msg m = { .producer = (long)arg };
+	char *buf = malloc(g_msgsz);
+
+	for(m.seq = 0; buf && m.seq < g_count; m.seq++) {
+		fill(buf, &m);
+		if(put(buf, msg_len(&m), m.producer % scull_nr_lanes) < 0)
+			break;
+	}
+	free(buf);
+	return NULL;
+}
+
+static void *consumer(void *arg) {
+	char *buf = malloc(g_msgsz);
+	long *last = calloc(g_producers, sizeof(*last));
+	struct iov_iter it;
+	struct msg m;
+	ssize_t len;
+	int i;
+
+	(void)arg;
+	for(i = 0; last && i < g_producers; i++)
+		last[i] = -1;
+	while(buf && last) {
+		iov_iter_buf(&it, buf, g_msgsz);
+		/* fragmented messages come whole or not at all, like read() */
+		len = scull_get(&g_dev, &it, 0,
+				scull_fifo_msgsz > scull_fifo_elemsz, true);
+		if(len < 0) {
+			error("get returned %zd", len);
+			break;
+		}
+		memcpy(&m, buf, sizeof(m));
+		if(len == g_msgsz && m.producer == POISON)
+			break;
+		check(buf, len, last);
+	}
+	free(last);
+	free(buf);
+	return NULL;
+}
+
+/* flip between the configured size and twice it until told to stop */
+static void *resizer(void *arg) {
+	int size = scull_fifo_size, ret;
+	long n = 0;
+
+	(void)arg;
+	while(!__atomic_load_n(&g_done, __ATOMIC_ACQUIRE)) {
+		size = (size == scull_fifo_size) ? 2 * scull_fifo_size
+						 : scull_fifo_size;
+		/* -EBUSY: too much queued to shrink right now */
+		if((ret = scull_resize(&g_dev, size)) < 0 && ret != -EBUSY)
+			error("resize returned %d", ret);
+		n++;
+		usleep(1000);
+	}
+	printf("resizes: %ld\n", n);
+	return NULL;
+}
+
+static int parse_arguments(int argc, char **argv) {
+	int opt;
+
+	while((opt = getopt(argc, argv, "m:s:k:o:f:L:w:e:M:p:c:n:l:vrh")) != -1) {
+		switch(opt) {
+		case 'm': scull_fifo_mode = atoi(optarg); break;
+		case 's': scull_fifo_size = atoi(optarg); break;
+		case 'k': scull_nr_lanes = atoi(optarg); break;
+		case 'o': scull_fifo_policy = atoi(optarg); break;
+		case 'f': scull_spill_dir = optarg; break;
+		case 'L': scull_fifo_layout = atoi(optarg); break;
+		case 'w': scull_spin_us = atoi(optarg); break;
+		case 'e': scull_fifo_elemsz = atoi(optarg); break;
+		case 'M': scull_fifo_msgsz = atoi(optarg); break;
+		case 'p': g_producers = atoi(optarg); break;
+		case 'c': g_consumers = atoi(optarg); break;
+		case 'n': g_count = atol(optarg); break;
+		case 'l': g_msgsz = atoi(optarg); break;
+		case 'v': g_vary = 1; break;
+		case 'r': g_resize = 1; break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if(scull_fifo_mode < SCULL_FIFO_MODE_LOCKED ||
+	   scull_fifo_mode > SCULL_FIFO_MODE_PRIO ||
+	   scull_fifo_size < 1 || g_producers < 1 || g_consumers < 1 ||
+	   scull_nr_lanes < 1 || scull_nr_lanes > SCULL_LANES_MAX ||
+	   scull_fifo_policy < SCULL_POLICY_BLOCK ||
+	   scull_fifo_policy > SCULL_POLICY_SPILL ||
+	   (scull_fifo_policy == SCULL_POLICY_SPILL && !scull_spill_dir) ||
+	   scull_fifo_layout < SCULL_LAYOUT_PACKED ||
+	   scull_fifo_layout > SCULL_LAYOUT_SPLIT ||
+	   scull_spin_us < 0 || scull_spin_us > SCULL_SPIN_MAX_US ||
+	   g_count < 1 || g_count > POISON ||
+	   scull_fifo_elemsz < 1 || scull_fifo_msgsz < 0 ||
+	   (scull_fifo_msgsz > scull_fifo_elemsz &&
+	    (scull_fifo_mode != SCULL_FIFO_MODE_LOCKED ||
+	     DIV_ROUND_UP(scull_fifo_msgsz, scull_fifo_elemsz) >
+	     scull_fifo_size)) ||
+	   g_msgsz < (int)sizeof(struct msg) || g_msgsz > scull_msg_max() ||
+	   (g_resize && scull_fifo_mode >= SCULL_FIFO_MODE_SHARDED)) {
+		fprintf(stderr, "%s: Invalid arguments\n", argv[0]);
+		usage(argv[0]);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	pthread_t *prod, *cons, resize;
+	struct msg poison = { .producer = POISON };
+	struct scull_stats stats;
+	struct iov_iter it;
+	char *buf;
+	long i, total, lost, missing = 0;
+	__u64 start, secs;
+	ssize_t len;
+
+	if(parse_arguments(argc, argv) < 0)
+		return EXIT_FAILURE;
+
+	total = g_producers * g_count;
+	prod = calloc(g_producers, sizeof(*prod));
+	cons = calloc(g_consumers, sizeof(*cons));
+	g_seen = calloc(total, 1);
+	buf = calloc(1, scull_msg_max());
+	if(!prod || !cons || !g_seen || !buf || scull_fifo_alloc(&g_dev)) {
+		fprintf(stderr, "stress: out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	start = ktime_get_ns();
+	for(i = 0; i < g_consumers; i++)
+		pthread_create(&cons[i], NULL, consumer, NULL);
+	for(i = 0; i < g_producers; i++)
+		pthread_create(&prod[i], NULL, producer, (void *)i);
+	if(g_resize)
+		pthread_create(&resize, NULL, resizer, NULL);
+
+	for(i = 0; i < g_producers; i++)
+		pthread_join(prod[i], NULL);
+	/*
+	 * One poison each; everything queued before it still gets read.
+	 * No more losses from here on, or a poison could be the one lost.
+	 */
+	__atomic_store_n(&g_dev.policy, SCULL_POLICY_BLOCK, __ATOMIC_RELAXED);
+	fill(buf, &poison);
+	for(i = 0; i < g_consumers; i++)
+		put(buf, g_msgsz, scull_nr_lanes - 1);
+	for(i = 0; i < g_consumers; i++)
+		pthread_join(cons[i], NULL);
+	secs = ktime_get_ns() - start;
+	__atomic_store_n(&g_done, 1, __ATOMIC_RELEASE);
+	if(g_resize)
+		pthread_join(resize, NULL);
+
+	/* a consumer can take its poison before other shards or lanes drain */
+	for(;;) {
+		iov_iter_buf(&it, buf, g_msgsz);
+		if((len = scull_get(&g_dev, &it, 0, false, false)) < 0)
+			break;
+		check(buf, len, NULL);
+	}
+	for(i = 0; i < total; i++)
+		if(!g_seen[i])
+			missing++;
+	lost = atomic64_read(&g_dev.lost);
+	if(missing != lost)
+		error("%ld of %ld messages missing, %ld lost", missing, total,
+		      lost);
+
+	scull_stats_sum(&g_dev, &stats);
+	printf("mode %d: %d producers, %d consumers, %ld msgs of %s%d bytes\n",
+	       scull_fifo_mode, g_producers, g_consumers, total,
+	       g_vary ? "up to " : "", g_msgsz);
+	printf("%.3f s, %.0f ops/sec, %llu full waits, %llu empty waits\n",
+	       secs / 1e9, total / (secs / 1e9),
+	       (unsigned long long)stats.full_waits,
+	       (unsigned long long)stats.empty_waits);
+	if(stats.spilled)
+		printf("%llu spilled, %llu bytes\n",
+		       (unsigned long long)stats.spilled,
+		       (unsigned long long)stats.spill_bytes);
+	if(scull_spin_us)
+		printf("%llu spin hits, %llu spin misses\n",
+		       (unsigned long long)stats.spin_hits,
+		       (unsigned long long)stats.spin_misses);
+	if(lost)
+		printf("%llu dropped, %llu overruns\n",
+		       (unsigned long long)stats.dropped,
+		       (unsigned long long)stats.overruns);
+	printf("%s\n", g_errors ? "FAILED" : "OK");
+
+	scull_fifo_free(&g_dev);
+	free(buf);
+	free(g_seen);
+	free(cons);
+	free(prod);
+	return g_errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
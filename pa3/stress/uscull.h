@@ -0,0 +1,419 @@
+/*
+ * uscull.h -- user-space stand-ins for the kernel interfaces fifo.c uses
+ *
+ * Just enough to run the FIFO core in a normal process, under perf or a
+ * sanitizer: atomics and barriers map to the compiler's __atomic builtins,
+ * semaphores/mutexes/rwsems to POSIX ones, wait queues to a mutex and a
+ * condition variable, and an iov_iter is a single user buffer, so
+ * copy_to_iter/copy_from_iter are memcpy() that never fault. There is one
+ * "CPU" of per-CPU data, updated atomically as every thread shares it.
+ * Kernel file I/O is pread()/pwrite() on a file descriptor.
+ */
+
+#ifndef _USCULL_H_
+#define _USCULL_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>		/* EPOLLIN and friends */
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <linux/types.h>
+
+typedef __u32 u32;
+typedef __u64 u64;
+typedef __s64 s64;
+typedef unsigned int __poll_t;
+
+#define __user
+#define __percpu
+#define ____cacheline_aligned_in_smp __attribute__((aligned(64)))
+
+#define ERESTARTSYS 512		/* never returned: nothing is interruptible */
+
+#define printk(...) do { } while (0)
+#define KERN_INFO ""
+#define KERN_WARNING ""
+#define KERN_NOTICE ""
+
+#define BUILD_BUG_ON(c) ((void)sizeof(char[1 - 2 * !!(c)]))
+#define U32_MAX UINT32_MAX
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b) min((t)(a), (t)(b))
+#define max_t(t, a, b) max((t)(a), (t)(b))
+#define min3(a, b, c) min(min(a, b), c)
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define swap(a, b) do { typeof(a) __t = (a); (a) = (b); (b) = __t; } while (0)
+#define ALIGN(x, a) (((x) + (a) - 1) & ~((typeof(x))(a) - 1))
+
+static inline int ilog2(u64 n)
+{
+	return 63 - __builtin_clzll(n);
+}
+
+/* memory: everything zeroed and cache-line aligned */
+#define PAGE_SIZE 4096UL
+#define PAGE_ALIGN(x) ALIGN(x, PAGE_SIZE)
+#define GFP_KERNEL 0
+
+static inline void *uscull_zalloc(size_t n)
+{
+	void *p;
+
+	n = ALIGN(n ? n : 1, 64);
+	p = aligned_alloc(64, n);
+	if (p)
+		memset(p, 0, n);
+	return p;
+}
+
+static inline void *uscull_zalloc_array(size_t n, size_t size)
+{
+	if (size && n > SIZE_MAX / size)
+		return NULL;
+	return uscull_zalloc(n * size);
+}
+
+#define kmalloc(n, gfp)			uscull_zalloc(n)
+#define kzalloc(n, gfp)			uscull_zalloc(n)
+#define kcalloc(n, size, gfp)		uscull_zalloc_array(n, size)
+#define kvmalloc(n, gfp)		uscull_zalloc(n)
+#define kvmalloc_array(n, size, gfp)	uscull_zalloc_array(n, size)
+#define vmalloc_user(n)			uscull_zalloc(n)
+#define kfree(p)			free(p)
+#define kvfree(p)			free(p)
+#define vfree(p)			free(p)
+
+/* atomics: the kernel's non-returning ops are unordered, the rest full */
+typedef __s32 atomic_t;		/* as scull.h declares them for user space */
+typedef __u64 atomic64_t;
+
+#define atomic_read(v)		__atomic_load_n(v, __ATOMIC_RELAXED)
+#define atomic_set(v, i)	__atomic_store_n(v, i, __ATOMIC_RELAXED)
+#define atomic_add(i, v)	((void)__atomic_fetch_add(v, i, __ATOMIC_RELAXED))
+#define atomic_inc(v)		atomic_add(1, v)
+#define atomic_dec(v)		((void)__atomic_fetch_sub(v, 1, __ATOMIC_RELAXED))
+#define atomic64_read(v)	__atomic_load_n(v, __ATOMIC_RELAXED)
+#define atomic64_add(i, v)	((void)__atomic_fetch_add(v, i, __ATOMIC_RELAXED))
+#define atomic64_inc(v)		atomic64_add(1, v)
+#define atomic64_inc_return(v)	__atomic_add_fetch(v, 1, __ATOMIC_SEQ_CST)
+
+static inline int atomic_cmpxchg(atomic_t *v, int old, int new)
+{
+	__atomic_compare_exchange_n(v, &old, new, 0, __ATOMIC_SEQ_CST,
+			__ATOMIC_RELAXED);
+	return old;
+}
+
+static inline int atomic_dec_if_positive(atomic_t *v)
+{
+	int c = __atomic_load_n(v, __ATOMIC_RELAXED);
+
+	do {
+		if (c <= 0)
+			return c - 1;
+	} while (!__atomic_compare_exchange_n(v, &c, c - 1, 0,
+				__ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+	return c - 1;
+}
+
+#ifdef __SANITIZE_THREAD__
+/* TSan doesn't model fences; a seq_cst RMW orders the same for it */
+static int uscull_mb __attribute__((unused));
+#define smp_mb() ((void)__atomic_fetch_add(&uscull_mb, 0, __ATOMIC_SEQ_CST))
+#else
+#define smp_mb()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+#define smp_mb__after_atomic()	smp_mb()
+#define smp_load_acquire(p)	__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define READ_ONCE(x)		__atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, v)	__atomic_store_n(&(x), v, __ATOMIC_RELAXED)
+
+/* let the other side run even when threads outnumber CPUs */
+#define cpu_relax()		sched_yield()
+#define cond_resched()		sched_yield()
+#define need_resched()		false
+#define fatal_signal_pending(task) false
+
+/* one set of "per-CPU" data, shared by all threads */
+#define alloc_percpu(type)	((type *)uscull_zalloc(sizeof(type)))
+#define free_percpu(p)		free(p)
+#define per_cpu_ptr(p, cpu)	((void)(cpu), (p))
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define this_cpu_inc(x)		((void)__atomic_fetch_add(&(x), 1, __ATOMIC_RELAXED))
+#define this_cpu_add(x, v)	((void)__atomic_fetch_add(&(x), v, __ATOMIC_RELAXED))
+#define this_cpu_read(x)	__atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define this_cpu_write(x, v)	__atomic_store_n(&(x), v, __ATOMIC_RELAXED)
+
+static inline int num_possible_cpus(void)
+{
+	return sysconf(_SC_NPROCESSORS_CONF);
+}
+
+/* shards are picked by thread id, like the kernel's task pid */
+#define current NULL
+#define task_pid_nr(task)	((int)syscall(SYS_gettid))
+
+#define NSEC_PER_USEC		1000ULL
+
+static inline u64 ktime_get_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* locks */
+struct semaphore {
+	sem_t sem;
+};
+
+static inline void sema_init(struct semaphore *s, int val)
+{
+	sem_init(&s->sem, 0, val);
+}
+
+static inline int down_interruptible(struct semaphore *s)
+{
+	while (sem_wait(&s->sem))
+		;	/* EINTR */
+	return 0;
+}
+
+static inline int down_trylock(struct semaphore *s)
+{
+	return sem_trywait(&s->sem) != 0;
+}
+
+static inline void up(struct semaphore *s)
+{
+	sem_post(&s->sem);
+}
+
+struct mutex {
+	pthread_mutex_t lock;
+};
+
+#define mutex_init(m)			pthread_mutex_init(&(m)->lock, NULL)
+#define mutex_trylock(m)		(pthread_mutex_trylock(&(m)->lock) == 0)
+#define mutex_lock_interruptible(m)	pthread_mutex_lock(&(m)->lock)
+#define mutex_unlock(m)			pthread_mutex_unlock(&(m)->lock)
+
+struct percpu_rw_semaphore {
+	pthread_rwlock_t lock;
+};
+
+#define percpu_init_rwsem(s)	pthread_rwlock_init(&(s)->lock, NULL)
+#define percpu_free_rwsem(s)	pthread_rwlock_destroy(&(s)->lock)
+#define percpu_down_read(s)	pthread_rwlock_rdlock(&(s)->lock)
+#define percpu_up_read(s)	pthread_rwlock_unlock(&(s)->lock)
+#define percpu_down_write(s)	pthread_rwlock_wrlock(&(s)->lock)
+#define percpu_up_write(s)	pthread_rwlock_unlock(&(s)->lock)
+
+/*
+ * Wait queues. The condition is checked under the queue's lock and
+ * wakers take it too, so a wake can't slip in between a waiter's check
+ * and its sleep; waiters is what waitqueue_active() looks at, and is
+ * raised before the first check as the kernel's prepare_to_wait() does.
+ * Every wake-up wakes everyone; exclusive waiters just go back to sleep.
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int waiters;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *wq)
+{
+	pthread_mutex_init(&wq->lock, NULL);
+	pthread_cond_init(&wq->cond, NULL);
+	wq->waiters = 0;
+}
+
+#define wait_event_interruptible(wq, condition) ({			\
+	pthread_mutex_lock(&(wq).lock);					\
+	__atomic_add_fetch(&(wq).waiters, 1, __ATOMIC_SEQ_CST);		\
+	smp_mb();							\
+	while (!(condition))						\
+		pthread_cond_wait(&(wq).cond, &(wq).lock);		\
+	__atomic_sub_fetch(&(wq).waiters, 1, __ATOMIC_SEQ_CST);		\
+	pthread_mutex_unlock(&(wq).lock);				\
+	0;								\
+})
+#define wait_event_interruptible_exclusive wait_event_interruptible
+
+static inline int waitqueue_active(wait_queue_head_t *wq)
+{
+	return __atomic_load_n(&wq->waiters, __ATOMIC_SEQ_CST);
+}
+
+static inline void uscull_wake_all(wait_queue_head_t *wq)
+{
+	pthread_mutex_lock(&wq->lock);
+	pthread_cond_broadcast(&wq->cond);
+	pthread_mutex_unlock(&wq->lock);
+}
+
+#define wake_up_interruptible_poll(wq, events)	uscull_wake_all(wq)
+#define wake_up_interruptible_all(wq)		uscull_wake_all(wq)
+
+/* an iov_iter over one user buffer; copies never fault */
+struct iov_iter {
+	char *buf;
+	size_t count;
+};
+
+static inline void iov_iter_buf(struct iov_iter *i, void *buf, size_t len)
+{
+	i->buf = buf;
+	i->count = len;
+}
+
+/* only ever used for empty, discarding iterators */
+#define READ 0
+
+struct kvec {
+	void *iov_base;
+	size_t iov_len;
+};
+
+static inline void iov_iter_kvec(struct iov_iter *i, unsigned int direction,
+		const struct kvec *kvec, unsigned long nr_segs, size_t count)
+{
+	iov_iter_buf(i, nr_segs ? kvec->iov_base : NULL, count);
+}
+
+static inline size_t iov_iter_count(const struct iov_iter *i)
+{
+	return i->count;
+}
+
+static inline void iov_iter_advance(struct iov_iter *i, size_t n)
+{
+	n = min(n, i->count);
+	i->buf += n;
+	i->count -= n;
+}
+
+static inline size_t copy_to_iter(const void *from, size_t n,
+		struct iov_iter *i)
+{
+	n = min(n, i->count);
+	if (n)
+		memcpy(i->buf, from, n);
+	iov_iter_advance(i, n);
+	return n;
+}
+
+static inline size_t copy_from_iter(void *to, size_t n, struct iov_iter *i)
+{
+	n = min(n, i->count);
+	if (n)
+		memcpy(to, i->buf, n);
+	iov_iter_advance(i, n);
+	return n;
+}
+
+/* error pointers */
+#define IS_ERR(p)	((unsigned long)(p) >= (unsigned long)-4095)
+#define PTR_ERR(p)	((long)(p))
+#define ERR_PTR(e)	((void *)(long)(e))
+
+static inline char *kasprintf(int gfp, const char *fmt, ...)
+{
+	va_list ap;
+	char *s;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (n < 0 || (s = malloc(n + 1)) == NULL)
+		return NULL;
+	va_start(ap, fmt);
+	vsnprintf(s, n + 1, fmt, ap);
+	va_end(ap);
+	return s;
+}
+
+/* files; loff_t comes from <sys/types.h> */
+#ifndef O_LARGEFILE
+#define O_LARGEFILE 0
+#endif
+#define FALLOC_FL_KEEP_SIZE	0x01
+#define FALLOC_FL_PUNCH_HOLE	0x02
+
+struct file {
+	int fd;
+};
+
+static inline struct file *filp_open(const char *path, int flags, int mode)
+{
+	struct file *f = malloc(sizeof(*f));
+
+	if (!f)
+		return ERR_PTR(-ENOMEM);
+	if ((f->fd = open(path, flags, mode)) < 0) {
+		free(f);
+		return ERR_PTR(-errno);
+	}
+	return f;
+}
+
+static inline int filp_close(struct file *f, void *id)
+{
+	close(f->fd);
+	free(f);
+	return 0;
+}
+
+static inline ssize_t kernel_read(struct file *f, void *buf, size_t n,
+		loff_t *pos)
+{
+	ssize_t ret = pread(f->fd, buf, n, *pos);
+
+	if (ret < 0)
+		return -errno;
+	*pos += ret;
+	return ret;
+}
+
+static inline ssize_t kernel_write(struct file *f, const void *buf, size_t n,
+		loff_t *pos)
+{
+	ssize_t ret = pwrite(f->fd, buf, n, *pos);
+
+	if (ret < 0)
+		return -errno;
+	*pos += ret;
+	return ret;
+}
+
+static inline int vfs_fallocate(struct file *f, int mode, loff_t off,
+		loff_t len)
+{
+	return syscall(SYS_fallocate, f->fd, mode, off, len) ? -errno : 0;
+}
+
+/* only there to be embedded in struct scull_dev */
+struct cdev {
+	int unused;
+};
+
+#endif /* _USCULL_H_ */